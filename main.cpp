@@ -9,7 +9,38 @@
 #include <vector>
 #include <ctime>
 #include <cmath>
-#include <string>
+#include <cstdarg>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define HAVE_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+#endif
 
 const int SCREEN_WIDTH = 800;
 const int SCREEN_HEIGHT = 600;
@@ -21,88 +52,844 @@ const int ATTACK_CHANGE_INTERVAL = 15000; // milliseconds
 const SDL_Color TEXT_COLOR = {255, 255, 255, 255}; // Black
 const SDL_Color RESTART_BUTTON_COLOR = {169, 169, 169, 255}; // Grey
 const int JOYSTICK_DEAD_ZONE = 8000; //Analog joystick dead zone
+const int SIM_TICK_RATE = 120; // simulation ticks per second
+const double SIM_TICK_SECONDS = 1.0 / SIM_TICK_RATE;
+const double MAX_FRAME_SECONDS = 0.25; // clamp long frames so the simulation doesn't spiral
+const int DEFAULT_FRAME_RATE = 60; // pacing target when neither --fps nor the display says otherwise
+const int MAX_FRAME_RATE = 1000;
+const double PACER_SPIN_SECONDS = 0.002; // wake this long before a deadline and spin the rest, covers sleep overshoot
+const int RENDER_SCALE_STEPS = 8; // the scene's internal resolution moves in eighths of the window size
+const int MIN_RENDER_SCALE = 4; // never below half the window size
+const int RENDER_SCALE_ADJUST_FRAMES = 30; // frames averaged before each scale change
+const float RENDER_SCALE_LOWER_LOAD = 0.9f; // share of the frame budget above which the scale drops a step
+const float RENDER_SCALE_RAISE_LOAD = 0.6f; // and below which it rises one, far enough apart not to oscillate
+const float PLAYER_SPEED = 300.0f; // pixels per second
+const float INITIAL_ATTACK_SPEED = 300.0f; // pixels per second
+const int MAX_ATTACKS = 16384; // attack pool capacity, spawns are dropped while it is full
+const int RENDER_QUEUE_RESERVE = MAX_ATTACKS + 1024; // copies per frame, every attack plus the player, background and text
+const int GRID_CELL_SIZE = ATTACK_SIZE; // no entity is larger than a cell, so overlaps only reach neighbouring cells
+const int GRID_ORIGIN = -ATTACK_SIZE; // attacks spawn up to ATTACK_SIZE off screen
+const int GRID_COLUMNS = (SCREEN_WIDTH - GRID_ORIGIN) / GRID_CELL_SIZE + 1;
+const int GRID_ROWS = (SCREEN_HEIGHT - GRID_ORIGIN) / GRID_CELL_SIZE + 1;
+const int GRID_CELLS = GRID_COLUMNS * GRID_ROWS;
+const int COLLISION_BATCH = 64; // grid candidates gathered per vectorized narrowphase call
+const int PARALLEL_ATTACK_COUNT = 4096; // attack count from which update() splits the attacks across workers
+const int ATTACK_CHUNK_SIZE = 1024; // attacks per job of the parallel update
+const int FIXED_SHIFT = 16; // attack kinematics are 16.16 fixed point
+const Sint32 FIXED_ONE = 1 << FIXED_SHIFT;
+const Sint32 MAX_ATTACK_STEP = 4096 * FIXED_ONE; // per-tick speed cap, far beyond crossing the screen in one tick
+const int ANGLE_BITS = 12;
+const int ANGLE_STEPS = 1 << ANGLE_BITS; // full circle in the direction lookup table
+const int ATAN_STEPS = 1024; // resolution of the 0..45 degree arctangent table
+const char TEXT_GLYPHS[] = " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~";
+const int HUD_FONT_SIZE = 14;
+const int ATTACK_SPRITES = 3; // attack%d.bmp variants, cycled every ATTACK_CHANGE_INTERVAL
+const int SPRITE_ATLAS_PADDING = 1; // transparent gap between packed sprites so filtering never bleeds
+const int HUD_WIDTH = 400;
+const int FRAME_ARENA_SIZE = 4096; // bytes of transient text a single frame can format
+const Uint32 ALLOCATION_WARMUP_FRAMES = 120; // frames before allocating counts against the steady state
+const int TIMING_HISTORY = 512; // frames kept for the rolling percentiles
+const int TIMING_SUMMARY_INTERVAL = 30; // frames between percentile refreshes
+const int TRACE_BUFFER_EVENTS = 1 << 16; // per-thread trace ring size, must be a power of two
+const Uint64 BENCH_SEED = 12345;
+const Uint32 BENCH_TICKS = 1200; // 10 simulated seconds
+const int BENCH_ATTACKS = 10000; // attacks kept alive at once by the stress scenario
+const int BENCH_SPAWNS_PER_TICK = 32;
+const int BENCH_RENDER_INTERVAL = 60; // ticks per rendered frame, 2 frames per simulated second
+const int BENCH_SNAPSHOT_RESTORES = 1000; // restores timed at the end of the stress scenario
+const Uint32 BENCH_SNAPSHOT_TICKS = 120; // ticks re-simulated from a restored snapshot to check it
+const int BENCH_JOB_BATCHES = 5000; // tiny back-to-back job batches run to check every index runs once
+const int BENCH_JOB_INDICES = 64; // largest of those batches
+const float ATTACK_SPEED_RAMP = 1.2f; // attack speed multiplier applied every ATTACK_CHANGE_INTERVAL
+const int MAX_WORKERS = 64; // job system threads, including the thread that submits the jobs
+const int MAX_TRACE_THREADS = MAX_WORKERS + 8; // job workers plus main, loader, audio and spares
+const int SWEEP_DEFAULT_RUNS = 64; // runs per parameter set unless --runs is given
+const Uint32 SWEEP_DEFAULT_MAX_TICKS = 10 * 60 * SIM_TICK_RATE; // runs surviving this long are cut off
+const int BOT_DECISION_TICKS = 6; // ticks between bot input decisions
+const float BOT_DANGER_RADIUS = 3.0f * ATTACK_SIZE; // dodge bot ignores attacks further away than this
+const int LOOKAHEAD_CANDIDATES = 9; // standing still plus the eight directions
+const int LOOKAHEAD_TICKS = 120; // ticks each candidate is played out for, one simulated second
+const int LOOKAHEAD_MIN_TICKS = 8 * BOT_DECISION_TICKS; // horizon floor when the frame budget forces it down, shorter ones stop seeing danger
+const double LOOKAHEAD_BUDGET_MS = 8.0; // per decision while rendering, leaves half a 60 Hz frame to draw
+const Uint32 REPLAY_MAGIC = 0x52444753; // "SGDR"
+const Uint32 REPLAY_VERSION = 2; // bumped whenever the simulation's outcomes change, old replays would diverge
+const Uint32 REPLAY_MAX_RUN = 0xffff; // longest run of identical inputs stored in one record
+const char FONT_PATH[] = "fonts/OpenSans-Regular.ttf";
+const char MUSIC_PATH[] = "audio/backgroundMusic.mp3";
+const char BUNDLE_PATH[] = "sgdodge.pak"; // used instead of the loose files above when present
+const Uint32 BUNDLE_MAGIC = 0x4b504753; // "SGPK"
+const Uint32 BUNDLE_VERSION = 2;
+const Uint32 BUNDLE_ALIGNMENT = 16; // chunk start alignment inside the bundle
+const int LOADING_BAR_WIDTH = 400;
+const int LOADING_BAR_HEIGHT = 20;
 
 SDL_Window* gWindow = NULL;
 SDL_Renderer* gRenderer = NULL;
 TTF_Font* gFont = NULL;
-SDL_Texture* gBackgroundTexture = NULL;
+TTF_Font* gHudFont = NULL;
+
+// A set of characters rendered once into a single texture and drawn from per-character sub-rects
+struct GlyphAtlas {
+    SDL_Texture* texture;
+    SDL_Rect rects[128]; // sub-rect per ASCII character, zero width when not in the atlas
+};
+
+GlyphAtlas gTextGlyphs = {};
+GlyphAtlas gHudGlyphs = {};
+SDL_Texture* gGameOverTexture = NULL; // render target holding the whole game-over screen, NULL if unsupported
+int gGameOverTextureTime = -1; // survival time currently baked into gGameOverTexture, -1 when stale
+
+// Every sprite image packed into one texture at load time, so the whole scene draws from a single
+// texture and the renderer never has to break a batch to switch textures
+enum Sprite {
+    SPRITE_BACKGROUND,
+    SPRITE_IDLE,
+    SPRITE_WALK,
+    SPRITE_ATTACK_FIRST,
+    SPRITE_COUNT = SPRITE_ATTACK_FIRST + ATTACK_SPRITES
+};
+
+const char* const SPRITE_PATHS[SPRITE_COUNT] = { "img/grass.bmp", "img/idle.bmp", "img/walking_sprite.bmp", "img/attack1.bmp", "img/attack2.bmp", "img/attack3.bmp" };
+
+struct SpriteAtlas {
+    SDL_Texture* texture;
+    SDL_Rect rects[SPRITE_COUNT]; // sub-rect of each Sprite inside the atlas texture
+    SDL_Texture* scaled[RENDER_SCALE_STEPS]; // atlas shrunk to each scene scale, sprites at scaleRect() of their rects
+    SDL_Texture* backgrounds[RENDER_SCALE_STEPS + 1]; // opaque background already stretched to the scene at each scale
+};
+
+SpriteAtlas gSprites = {};
+
+// Asset bundle written by --pack: a header followed by the sprite atlas pixels, already converted
+// to the texture format renderers prefer, and the raw font and music files. The game maps the
+// bundle read-only and hands textures, fonts and music pointers straight into the mapping.
+enum BundleChunk {
+    BUNDLE_ATLAS_PIXELS,
+    BUNDLE_FONT,
+    BUNDLE_MUSIC,
+    BUNDLE_CHUNK_COUNT
+};
+
+// Every field is a little-endian 32 bit word, so the header is read in place from the mapping
+struct BundleHeader {
+    Uint32 magic, version;
+    Uint32 atlasFormat, atlasWidth, atlasHeight, atlasPitch;
+    Sint32 spriteRects[SPRITE_COUNT][4]; // x, y, w, h of each Sprite
+    Uint32 chunkOffset[BUNDLE_CHUNK_COUNT], chunkSize[BUNDLE_CHUNK_COUNT];
+};
+
+struct AssetBundle {
+    const Uint8* data; // NULL when running from loose files
+    size_t size;
+    bool mapped; // data is an mmap of the file rather than a heap copy
+};
+
+AssetBundle gBundle = {};
+
+// Assets decoded off the main thread. The loader thread posts each finished item to a small
+// locked queue, and the main thread turns them into textures and music as it drains the queue.
+enum LoadItem {
+    LOAD_SPRITE_ATLAS, // critical, the game can't draw a frame without it
+    LOAD_MUSIC,
+    LOAD_ITEM_COUNT
+};
+
+const int LOAD_PROGRESS_STEPS = SPRITE_COUNT + 1; // one per sprite image plus the music
+
+struct LoadedAsset {
+    LoadItem item;
+    bool failed;
+    SDL_Surface* surface; // packed sprite atlas, NULL when it comes from the bundle mapping
+    SDL_Rect rects[SPRITE_COUNT];
+    Mix_Music* music;
+};
+
+struct AssetLoader {
+    SDL_Thread* thread; // NULL once every item has been received and the thread joined
+    SDL_mutex* lock; // guards queue and queued
+    LoadedAsset queue[LOAD_ITEM_COUNT]; // every item is posted exactly once
+    int queued, received;
+    SDL_atomic_t progress; // decoded steps out of LOAD_PROGRESS_STEPS, for the loading screen
+};
+
+AssetLoader gLoader = {};
 Mix_Music* gBackgroundMusic = NULL;
 SDL_Joystick* gGameController = NULL;
 
-int survivalTime = 0;
+SDL_atomic_t gAllocationCount; // C++ heap allocations since startup
+SDL_atomic_t gSdlAllocationCount; // allocations made through SDL_malloc and friends since startup
+thread_local Uint32 gThreadAllocations; // C++ and SDL allocations made by the calling thread
+
+// Allocator SDL had before installCountingAllocator() wrapped it
+SDL_malloc_func gSdlMalloc = NULL;
+SDL_calloc_func gSdlCalloc = NULL;
+SDL_realloc_func gSdlRealloc = NULL;
+SDL_free_func gSdlFree = NULL;
+
+// Bump allocator for text that only lives until the frame is presented, reset by render()
+struct FrameArena {
+    char buffer[FRAME_ARENA_SIZE];
+    int used;
+};
+
+FrameArena gFrameArena = {};
+
+void* operator new(size_t size) {
+    SDL_AtomicIncRef(&gAllocationCount);
+    gThreadAllocations++;
+    void* memory = malloc(size ? size : 1);
+    if (memory == NULL) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+// C++14 calls this one when the size is known. Kept out of line, otherwise GCC sees the free()
+// inlined at each delete of a new'd object and warns about mismatched allocation functions.
+NOINLINE void operator delete(void* memory, size_t) noexcept {
+    operator delete(memory);
+}
+
+bool gHasAVX2 = false;
+
+bool gHeadless = false; // simulate without presenting anything, as fast as possible
+bool gBenchmark = false; // run the scripted stress scenario and print throughput as JSON
+FILE* gBenchOutput = NULL; // the original stdout, which only gets the benchmark's JSON
+Uint32 gMaxTicks = 0; // stop a headless run after this many ticks, 0 runs until game over
+Uint64 gSeed = 0; // simulation RNG seed, taken from the clock unless given or replayed
+const char* gRecordPath = NULL; // write a replay of this session here
+const char* gPlayPath = NULL; // re-simulate this replay headless instead of playing
+const char* gPackPath = NULL; // write an asset bundle here and exit
+const char* gSweepPath = NULL; // run a difficulty parameter sweep and write its CSV here
+
+// Small self-contained PCG32 generator so runs don't depend on the C library's rand()
+struct Rng {
+    Uint64 state;
+};
+
+enum FramePhase {
+    PHASE_EVENTS,
+    PHASE_UPDATE,
+    PHASE_BACKGROUND,
+    PHASE_SPRITES,
+    PHASE_TEXT,
+    PHASE_PACE, // waiting for the frame pacer's deadline
+    PHASE_PRESENT,
+    PHASE_FRAME, // whole frame, including anything not covered by the phases above
+    PHASE_COUNT
+};
+
+const char* const PHASE_NAMES[PHASE_COUNT] = { "events", "update", "background", "sprites", "text", "pace", "present", "frame" };
+
+// Milliseconds spent per phase: the frame in progress, a ring of recent frames, and the
+// percentiles over that ring which the HUD shows
+struct FrameTimings {
+    double counterToMilliseconds;
+    Uint64 frameStart;
+    float current[PHASE_COUNT];
+    float history[PHASE_COUNT][TIMING_HISTORY];
+    int historyCount, historyNext;
+    float p50[PHASE_COUNT], p95[PHASE_COUNT], p99[PHASE_COUNT], max[PHASE_COUNT];
+    Uint32 frames;
+    Uint32 allocationsAtStart; // gThreadAllocations when the frame began
+    Uint32 allocations; // heap allocations the main thread made during the last frame
+    Uint32 allocatingFrames; // frames past the warmup that allocated at all
+    FILE* csv; // one row per frame when streaming is enabled
+    bool hudVisible;
+};
+
+FrameTimings gTimings = {};
+const char* gTimingsPath = NULL; // stream per-frame timings to this CSV file
+
+// Presents frames at a fixed rate: vsync does the waiting when the display refreshes at the
+// target rate, otherwise each frame sleeps until shortly before its deadline and spins the rest
+struct FramePacer {
+    int frameRate; // 0 while pacing is off, e.g. headless
+    bool vsync; // presents are synchronized to the display
+    bool sleeps; // deadlines are kept by sleeping and spinning rather than by vsync alone
+    Uint64 period; // performance counter ticks per frame
+    Uint64 spin; // ticks before a deadline where sleeping stops
+    Uint64 deadline; // when the next frame should be presented
+    Uint64 lastPresent;
+    Uint32 missedDeadlines;
+};
+
+FramePacer gPacer = {};
+int gTargetFrameRate = 0; // --fps, 0 follows the display refresh rate
+
+// The scene (background and sprites) is drawn into a render target at a fraction of the window
+// size and stretched to the window, text is drawn afterwards at full resolution
+struct DynamicResolution {
+    SDL_Texture* target; // window sized, the scene only fills its top-left corner; NULL draws directly
+    int scale; // in RENDER_SCALE_STEPS of the window size
+    bool pinned; // the scale never adapts
+    float workMilliseconds; // summed over the frames since the last adjustment
+    int frames;
+    Uint32 changes;
+};
+
+DynamicResolution gResolution = {};
+int gRenderScalePercent = 0; // --render-scale, 0 adapts the scale to frame times
+
+// One complete ("X") event of a Chrome trace, times are performance counter values
+struct TraceEvent {
+    const char* name; // must outlive the trace, string literals in practice
+    Uint64 start, end;
+};
+
+// Ring of the latest events of one thread. Only the owning thread writes, it publishes each
+// event by bumping written, so flushing from another thread needs no lock.
+struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    SDL_atomic_t written; // events ever recorded, the ring holds the last TRACE_BUFFER_EVENTS
+    const char* threadName;
+};
+
+struct Tracer {
+    bool enabled;
+    Uint64 origin;
+    double counterToMicroseconds;
+    void* buffers[MAX_TRACE_THREADS]; // TraceBuffer*, published with SDL_AtomicSetPtr
+    SDL_atomic_t bufferCount;
+};
+
+Tracer gTracer = {};
+thread_local TraceBuffer* gTraceBuffer = NULL; // the calling thread's ring, NULL until it traces
+const char* gTracePath = NULL; // write a Chrome trace JSON here on exit and on F4
+
+// Records the enclosing scope as a trace event, costs one branch while tracing is off
+struct TraceScope {
+    const char* name;
+    Uint64 start;
+    TraceScope(const char* name);
+    ~TraceScope();
+};
+bool gCheckAllocations = false; // abort when a frame past the warmup touches the heap
+
+// Input consumed by one simulation tick, a replay is one of these per tick
+enum InputBits {
+    INPUT_UP = 1 << 0,
+    INPUT_DOWN = 1 << 1,
+    INPUT_LEFT = 1 << 2,
+    INPUT_RIGHT = 1 << 3,
+    INPUT_FACE_RIGHT = 1 << 4, // player sprite flipped to face right
+    INPUT_RESTART = 1 << 5 // the game was restarted before this tick
+};
+
+// Replay file: magic, version, seed, tick count, then (input byte, 16 bit run length) records
+struct Replay {
+    SDL_RWops* file;
+    bool recording;
+    Uint64 seed;
+    Uint32 ticks; // ticks written so far, or ticks left to play back
+    Uint8 runInput;
+    Uint32 runLength;
+};
 
 struct GameObject {
-    int x, y;
+    float x, y;
+    float prevX, prevY; // position at the start of the last simulation tick
     int size;
-    int velX, velY;
+    float velX, velY; // pixels per second
     int frame;
-    SDL_Texture* texture;
+    int sprite; // index into gSprites.rects
     SDL_RendererFlip flip; // Flip state for rendering
 };
 
+// Uniform grid broadphase over attack positions. Every cell is an intrusive linked list of the
+// attacks whose top-left corner lies in it, and attacks are only relinked when they change cell.
+struct SpatialGrid {
+    int head[GRID_CELLS]; // first attack in each cell, -1 when empty
+    int next[MAX_ATTACKS], prev[MAX_ATTACKS];
+    Sint16 cell[MAX_ATTACKS]; // cell each attack is currently linked into
+};
+
+// 16.16 fixed point pixels, or pixels per tick for velocities
+typedef Sint32 Fixed;
+
+// Unit direction per angle step and arctangent of 0..1 in angle steps, filled by initAngleTables()
+Fixed gDirectionX[ANGLE_STEPS], gDirectionY[ANGLE_STEPS];
+Uint16 gArctangent[ATAN_STEPS + 1];
+
+// Attacks live in parallel arrays so the per-tick loops only touch the fields they need.
+// Capacity is fixed up front and removal is swap-and-pop, so nothing allocates after startup.
+struct AttackPool {
+    int count;
+    Fixed x[MAX_ATTACKS], y[MAX_ATTACKS];
+    Fixed prevX[MAX_ATTACKS], prevY[MAX_ATTACKS]; // position at the start of the last simulation tick
+    Fixed velX[MAX_ATTACKS], velY[MAX_ATTACKS]; // pixels per tick, integrated with plain adds
+    Uint8 sprite[MAX_ATTACKS]; // attack variant, offset from SPRITE_ATTACK_FIRST
+    SpatialGrid grid;
+    bool gridStale; // the parallel update doesn't maintain the grid, the serial one rebuilds it first
+};
+
+// Difficulty parameters, the compile-time constants by default and varied by the sweep runner
+struct Tuning {
+    int spawnInterval; // milliseconds between attack spawns
+    int changeInterval; // milliseconds between attack sprite changes and speed ramps
+    float initialAttackSpeed; // pixels per second
+    float speedRamp; // attack speed multiplier applied every changeInterval
+};
+
+// All state of one simulation. Nothing in here points at the window, renderer or mixer, which stay
+// process-wide attachments that only read a world, so any number of worlds can be stepped
+// independently, one per thread if need be. Holds a full AttackPool, so allocate it on the heap.
+struct World {
+    Tuning tuning;
+    GameObject player;
+    Rng random;
+    Uint32 simTicks;
+    int lastSpawnTime; // milliseconds of simulated time
+    float attackSpeed; // pixels per second for newly spawned attacks
+    Fixed maxAttackStep; // longest per-tick step of any attack spawned since the attacks were last cleared
+    bool gameOver;
+    int survivalTime; // milliseconds survived by the run that ended in game over
+    bool invulnerable; // collisions are still tested but never end the game
+    int ignoredCollisions; // ticks where an invulnerable player was hit
+    AttackPool attacks; // last, snapshots copy everything before it as one block
+};
+
+static_assert(std::is_trivially_copyable<World>::value, "World must stay plain data for snapshots");
+
+// Compact copy of a World for rollback and search: every World member declared before attacks
+// as one block, then only the live attacks, packed field by field. It holds no pointers, so
+// copying its first `size` bytes with a single memcpy duplicates it. Allocate it on the heap.
+struct Snapshot {
+    Uint32 size; // bytes in use, counted from the start of the struct
+    int attackCount;
+    Uint8 world[offsetof(World, attacks)];
+    Uint8 attacks[MAX_ATTACKS * (6 * sizeof(Fixed) + sizeof(Uint8))]; // x, y, prevX, prevY, velX, velY, sprite
+};
+
+// Work-stealing job system. A batch is an index range split evenly between the workers; each
+// worker takes small chunks off the front of its own range and, once that is empty, steals the
+// back half of the largest range left. The submitting thread works as worker 0.
+typedef void (*JobFunction)(void* data, int index, int worker);
+
+struct JobSystem;
+
+struct JobWorkerStart {
+    JobSystem* system;
+    int worker;
+};
+
+struct WorkerRange {
+    SDL_SpinLock lock;
+    int next, end; // indices not yet taken
+};
+
+struct JobSystem {
+    int workerCount;
+    SDL_Thread* threads[MAX_WORKERS]; // threads[0] is unused, worker 0 is the submitter
+    JobWorkerStart starts[MAX_WORKERS];
+    WorkerRange ranges[MAX_WORKERS];
+    SDL_sem* wake; // posted once per helper thread for every batch
+    SDL_atomic_t remaining; // indices of the current batch not yet finished
+    SDL_atomic_t busy; // helper threads inside runAvailableJobs(), possibly still from the last batch
+    SDL_atomic_t quit;
+    JobFunction function; // written before the ranges are published
+    void* data;
+    int grain; // indices taken per chunk
+};
+
+
+// Input policies driving headless runs without a human
+enum BotPolicy {
+    BOT_IDLE, // never moves
+    BOT_RANDOM, // random direction every BOT_DECISION_TICKS
+    BOT_DODGE, // steers away from the nearest attacks and back toward the centre
+    BOT_LOOKAHEAD // plays every move out on a copy of the world and takes the one that lasts
+};
+
+const char* const BOT_POLICY_NAMES[] = { "idle", "random", "dodge", "lookahead" };
+
+// The lookahead bot branches the current state into one rollout per candidate move and holds
+// that move until the horizon or a hit. Holding beats handing over to the dodge bot once attacks
+// get fast, the dodge bot steers into them.
+struct LookaheadBot {
+    JobSystem* jobs; // rollouts run across these workers, NULL runs them on the calling thread
+    Snapshot* root; // state being decided on
+    World* scratch[MAX_WORKERS]; // one rollout world per worker
+    int horizon; // ticks per rollout
+    double budgetMilliseconds; // shrink the horizon while decisions take longer, 0 keeps it fixed
+    float scores[LOOKAHEAD_CANDIDATES];
+};
+
+// Result of one chunk of a parallel attack update
+struct AttackChunk {
+    int hit; // lowest index in the chunk that hit the player, -1 for none
+    int removedCount; // off-screen attacks, listed ascending from removed[chunk * ATTACK_CHUNK_SIZE]
+};
+
+struct AttackUpdateJobs {
+    AttackPool* attacks;
+    const GameObject* player;
+    Fixed bounds[4]; // player query box, see playerQueryBounds()
+    AttackChunk chunks[MAX_ATTACKS / ATTACK_CHUNK_SIZE];
+    int removed[MAX_ATTACKS];
+};
+
+int gThreadCount = 0; // --threads, workers for sweeps, bot rollouts and attack updates, 0 uses every core
+JobSystem* gJobs = NULL; // shared by bot rollouts and large attack updates
+thread_local JobSystem* gAttackJobs = NULL; // set on the thread allowed to split update() into jobs
+AttackUpdateJobs gAttackUpdate; // scratch for the one thread that has gAttackJobs
+LookaheadBot gLookahead = {};
+bool gBotPlays = false; // --bot, inputs come from gBotPolicy instead of the keyboard or controller
+BotPolicy gBotPolicy = BOT_LOOKAHEAD;
+Rng gBotRng;
+
+struct SweepRange {
+    float min, max, step;
+};
+
+struct SweepConfig {
+    SweepRange spawnInterval, changeInterval, attackSpeed, speedRamp;
+    int runs; // seeds gSeed .. gSeed + runs - 1, identical for every parameter set
+    BotPolicy policy;
+};
+
+SweepConfig gSweep = { { ATTACK_SPAWN_INTERVAL, ATTACK_SPAWN_INTERVAL, 1 }, { ATTACK_CHANGE_INTERVAL, ATTACK_CHANGE_INTERVAL, 1 },
+                       { INITIAL_ATTACK_SPEED, INITIAL_ATTACK_SPEED, 1 }, { ATTACK_SPEED_RAMP, ATTACK_SPEED_RAMP, 1 }, SWEEP_DEFAULT_RUNS, BOT_DODGE };
+
+bool parseArgs(int argc, char* args[]);
 bool init();
-bool loadMedia(GameObject& player, SDL_Texture*& walkTexture, int& walkFrames, std::vector<SDL_Texture*>& attackTextures);
-void close(std::vector<SDL_Texture*>& attackTextures);
-SDL_Texture* loadTexture(const char* path);
-SDL_Texture* renderText(const std::string &message, SDL_Color color);
-void handleEvents(bool& quit, GameObject& player, bool& gameOver, int& startTime, std::vector<GameObject>& attacks);
-void update(GameObject& player, std::vector<GameObject>& attacks, int& lastSpawnTime, bool& gameOver, float attackSpeed, const std::vector<SDL_Texture*>& attackTextures, int elapsedTime);
-void render(const GameObject& player, SDL_Texture* walkTexture, int walkFrames, const std::vector<GameObject>& attacks, int elapsedTime, bool gameOver, int survivalTime);
-bool checkCollision(const GameObject& a, const GameObject& b);
+bool loadMedia(int& walkFrames, bool& quit);
+void close();
+bool createSpriteAtlas(SpriteAtlas& atlas, SDL_Surface* atlasSurface, const SDL_Rect rects[SPRITE_COUNT]);
+SDL_Surface* packSpriteSurface(SDL_Rect rects[SPRITE_COUNT], SDL_atomic_t* progress);
+bool packAssets(const char* path);
+bool openAssetBundle(AssetBundle& bundle, const char* path);
+void closeAssetBundle(AssetBundle& bundle);
+SDL_RWops* openBundleChunk(const AssetBundle& bundle, BundleChunk chunk);
+bool createSpriteAtlasFromBundle(SpriteAtlas& atlas, const AssetBundle& bundle);
+void createScaledSprites(SpriteAtlas& atlas, SDL_Surface* atlasSurface);
+void createBackgrounds(SpriteAtlas& atlas, SDL_Surface* atlasSurface);
+void reserveRenderQueue(SDL_Texture* texture);
+SDL_Rect scaleRect(const SDL_Rect& rect, int scale);
+TTF_Font* openFont(int size);
+bool startAssetLoader(AssetLoader& loader);
+int assetLoaderThread(void* data);
+bool pumpAssetLoader(AssetLoader& loader);
+void finishAssetLoader(AssetLoader& loader);
+void renderLoadingScreen(const AssetLoader& loader);
+bool buildGlyphAtlas(GlyphAtlas& atlas, TTF_Font* font, const char* characters);
+int renderGlyphText(const GlyphAtlas& atlas, const char* text, int x, int y);
+int measureGlyphText(const GlyphAtlas& atlas, const char* text);
+void installCountingAllocator();
+void resetFrameArena();
+const char* frameFormat(const char* format, ...);
+bool initTimings();
+void closeTimings();
+void initFramePacer(FramePacer& pacer, int targetRate, int refreshRate);
+void waitForFrameDeadline(FramePacer& pacer);
+void presentFrame(Uint64 phaseStart);
+int beginScene();
+void endScene();
+void adjustRenderScale(DynamicResolution& resolution);
+void initTrace();
+void closeTrace();
+TraceBuffer* traceThread(const char* name);
+void traceEvent(const char* name, Uint64 start, Uint64 end);
+bool writeTrace(const char* path);
+void SDLCALL traceAudioMix(void* userdata, Uint8* stream, int length);
+Uint64 beginFrameTiming();
+Uint64 endPhase(FramePhase phase, Uint64 start);
+void endFrameTiming();
+void summarizeTimings();
+void renderTimingHud();
+void renderGameOverScreen(int survivalTime);
+bool bakeGameOverScreen(int survivalTime);
+void handleEvents(bool& quit, World& world);
+void update(World& world);
+void render(const World& world, float alpha);
+void stepSimulation(World& world);
+void runHeadless(World& world, Replay& replay);
+void separateBenchOutput();
+bool drawsFrames();
+bool runBenchmark(World& world);
+void spawnAttackFromEdge(World& world, int sprite);
+bool checkCollision(Fixed ax, Fixed ay, int aSize, Fixed bx, Fixed by, int bSize);
+int findFirstInBounds(Fixed minX, Fixed maxX, Fixed minY, Fixed maxY, const Fixed* xs, const Fixed* ys, int count);
+bool sweptCollision(const GameObject& player, const AttackPool& attacks, int index);
+int findPlayerCollision(const GameObject& player, const AttackPool& attacks, Fixed maxStep);
+Fixed attackStep(float attackSpeed);
+void forEachAttackPair(AttackPool& attacks, void (*callback)(int a, int b, void* userdata), void* userdata);
+bool spawnAttack(AttackPool& attacks, Fixed x, Fixed y, Fixed velX, Fixed velY, int sprite);
+void removeAttack(AttackPool& attacks, int index);
+void clearAttacks(AttackPool& attacks);
+void saveSnapshot(const World& world, Snapshot& snapshot);
+void restoreSnapshot(World& world, const Snapshot& snapshot);
+void copySnapshot(Snapshot& destination, const Snapshot& source);
+void updateGrid(AttackPool& attacks);
+int ticksToMilliseconds(Uint32 ticks);
+int interpolate(float previous, float current, float alpha);
+int interpolate(Fixed previous, Fixed current, float alpha);
+Fixed toFixed(float value);
+float fromFixed(Fixed value);
+void initAngleTables();
+int angleOf(Sint32 dx, Sint32 dy);
+void integrateAttacks(AttackPool& attacks);
+void integrateAttackRange(AttackPool& attacks, int start, int end);
+int updateAttacksParallel(JobSystem& system, const GameObject& player, AttackPool& attacks, Fixed maxStep);
+void runAttackChunkJob(void* data, int index, int worker);
+void compactAttacks(AttackPool& attacks, AttackUpdateJobs& jobs);
+void rebuildGrid(AttackPool& attacks);
+bool attackOffScreen(const AttackPool& attacks, int i);
+void seedRandom(Rng& rng, Uint64 seed);
+Uint32 nextRandom(Rng& rng);
+int randomInt(Rng& rng, int bound);
+void resetWorld(World& world, Uint64 seed);
+void resetWorld(World& world, Uint64 seed, const Tuning& tuning);
+void restartGame(World& world);
+void restartMusic();
+Uint8 encodeInput(const GameObject& player, bool restarted);
+void applyInput(Uint8 input, GameObject& player);
+Uint32 hashState(const World& world);
+bool startJobSystem(JobSystem& system, int workerCount);
+void stopJobSystem(JobSystem& system);
+void runJobs(JobSystem& system, JobFunction function, void* data, int count, int grain);
+bool runAvailableJobs(JobSystem& system, int worker);
+int jobWorkerThread(void* data);
+Uint8 botInput(const World& world, BotPolicy policy, Rng& rng, Uint8 previous, LookaheadBot* lookahead);
+bool startLookaheadBot(LookaheadBot& bot, JobSystem* jobs, double budgetMilliseconds);
+void stopLookaheadBot(LookaheadBot& bot);
+Uint8 lookaheadInput(LookaheadBot& bot, const World& world, Uint8 previous);
+void runLookaheadJob(void* data, int index, int worker);
+bool parseSweepRange(const char* text, SweepRange& range);
+bool parseBotPolicy(const char* text, BotPolicy& policy);
+bool runSweep(const char* path);
+bool openReplayForWriting(Replay& replay, const char* path, Uint64 seed);
+bool openReplayForReading(Replay& replay, const char* path);
+void recordReplayInput(Replay& replay, Uint8 input);
+bool nextReplayInput(Replay& replay, Uint8& input);
+void closeReplay(Replay& replay);
 
 int main(int argc, char* args[]) {
+    // Must precede anything that could allocate through SDL
+    installCountingAllocator();
+    if (!parseArgs(argc, args)) {
+        return -1;
+    }
+    if (gBenchmark) {
+        separateBenchOutput();
+    }
+    initAngleTables();
+    initTrace();
+    // Before the sweep, its simulations take the same vectorized paths as the game
+    gHasAVX2 = SDL_HasAVX2();
+
+    if (gPackPath != NULL) {
+        return packAssets(gPackPath) ? 0 : -1;
+    }
+
+    if (gSweepPath != NULL) {
+        bool success = runSweep(gSweepPath);
+        closeTrace();
+        return success ? 0 : -1;
+    }
+
     if (!init()) {
         printf("Failed to iniialize!\n");
         return -1;
     }
 
+    if (!initTimings()) {
+        return -1;
+    }
+
+    Replay replay = {};
+    if (gPlayPath != NULL) {
+        if (!openReplayForReading(replay, gPlayPath)) {
+            return -1;
+        }
+        gSeed = replay.seed;
+    } else if (gRecordPath != NULL && !openReplayForWriting(replay, gRecordPath, gSeed)) {
+        return -1;
+    }
+
     bool quit = false;
-    bool gameOver = false;
-    int startTime = SDL_GetTicks();
-    GameObject player = { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, PLAYER_SIZE, 0, 0, NULL, 0, SDL_FLIP_NONE };
-    std::vector<GameObject> attacks;
-    std::vector<SDL_Texture*> attackTextures;
-    SDL_Texture* walkTexture = NULL;
+    World& world = *new World();
+    resetWorld(world, gSeed);
     int walkFrames = 0;
-    int lastSpawnTime = 0;
 
-    if (!loadMedia(player, walkTexture, walkFrames, attackTextures)) {
+    int workerCount = gThreadCount > 0 ? gThreadCount : SDL_GetCPUCount();
+    if (workerCount > 1) {
+        gJobs = new JobSystem();
+        if (!startJobSystem(*gJobs, workerCount)) {
+            return -1;
+        }
+        gAttackJobs = gJobs;
+    }
+
+    if (gBotPlays) {
+        seedRandom(gBotRng, ~gSeed);
+        // Only a rendered game has a frame budget to keep, headless runs stay reproducible
+        if (gBotPolicy == BOT_LOOKAHEAD && !startLookaheadBot(gLookahead, gJobs, gHeadless ? 0 : LOOKAHEAD_BUDGET_MS)) {
+            return -1;
+        }
+    }
+
+    if (!loadMedia(walkFrames, quit)) {
         printf("Failed to load media!\n");
         return -1;
     }
 
     int lastFrameTime = 0;
-    float attackSpeed = 5;
 
-    // Start playing background music
-    if (Mix_PlayingMusic() == 0) {
-        Mix_PlayMusic(gBackgroundMusic, -1);
+    if (gBenchmark) {
+        bool passed = runBenchmark(world);
+        stopLookaheadBot(gLookahead);
+        closeTimings();
+        close();
+        delete &world;
+        return passed ? 0 : 1;
     }
 
+    if (gHeadless) {
+        runHeadless(world, replay);
+        stopLookaheadBot(gLookahead);
+        closeReplay(replay);
+        closeTimings();
+        close();
+        delete &world;
+        return 0;
+    }
+
+    // Simulation runs at a fixed SIM_TICK_RATE, rendering runs as fast as the display allows
+    const double counterFrequency = (double)SDL_GetPerformanceFrequency();
+    Uint64 previousCounter = SDL_GetPerformanceCounter();
+    double accumulator = 0.0;
+    bool restarted = false;
+
     while (!quit) {
-        handleEvents(quit, player, gameOver, startTime, attacks);
-        int elapsedTime = SDL_GetTicks() - startTime;
+        Uint64 phaseStart = beginFrameTiming();
+        Uint64 currentCounter = SDL_GetPerformanceCounter();
+        double frameSeconds = (currentCounter - previousCounter) / counterFrequency;
+        previousCounter = currentCounter;
+        if (frameSeconds > MAX_FRAME_SECONDS) {
+            frameSeconds = MAX_FRAME_SECONDS;
+        }
+        accumulator += frameSeconds;
 
-        if (!gameOver) {
-            update(player, attacks, lastSpawnTime, gameOver, attackSpeed, attackTextures, elapsedTime);
-            attackSpeed = attackSpeed * ((elapsedTime % ATTACK_CHANGE_INTERVAL) == 0 ? 1.2 : 1); // Increase attack speed by 20% every 30 seconds
+        bool wasGameOver = world.gameOver;
+        handleEvents(quit, world);
+        restarted = restarted || (wasGameOver && !world.gameOver);
+        if (gLoader.thread != NULL) {
+            pumpAssetLoader(gLoader); // music may still be on its way
         }
-        render(player, walkTexture, walkFrames, attacks, elapsedTime, gameOver, survivalTime);
+        phaseStart = endPhase(PHASE_EVENTS, phaseStart);
+
+        while (accumulator >= SIM_TICK_SECONDS) {
+            if (!world.gameOver) {
+                if (gBotPlays) {
+                    applyInput(botInput(world, gBotPolicy, gBotRng, encodeInput(world.player, false), &gLookahead), world.player);
+                }
+                recordReplayInput(replay, encodeInput(world.player, restarted));
+                restarted = false;
+                stepSimulation(world);
+            }
+            accumulator -= SIM_TICK_SECONDS;
+        }
+        endPhase(PHASE_UPDATE, phaseStart);
+
+        float alpha = (float)(accumulator / SIM_TICK_SECONDS);
+        render(world, alpha);
 
         int currentTime = SDL_GetTicks();
         if (currentTime - lastFrameTime > ANIMATION_SPEED) {
-            player.frame = (player.frame + 1) % walkFrames;
+            world.player.frame = (world.player.frame + 1) % walkFrames;
             lastFrameTime = currentTime;
         }
-
-        SDL_Delay(16);
+        endFrameTiming();
+        adjustRenderScale(gResolution);
     }
 
-    close(attackTextures);
+    if (replay.recording) {
+        printf("Recorded %u ticks with seed %llu, state hash %08x\n", replay.ticks, (unsigned long long)gSeed, hashState(world));
+    }
+    stopLookaheadBot(gLookahead);
+    closeReplay(replay);
+    closeTimings();
+    close();
+    delete &world;
     return 0;
 }
 
+bool parseArgs(int argc, char* args[]) {
+    gSeed = (Uint64)time(NULL);
+    for (int i = 1; i < argc; ++i) {
+        if (SDL_strcmp(args[i], "--headless") == 0) {
+            gHeadless = true;
+        } else if (SDL_strcmp(args[i], "--ticks") == 0 && i + 1 < argc) {
+            gMaxTicks = (Uint32)SDL_strtoul(args[++i], NULL, 10);
+        } else if (SDL_strcmp(args[i], "--seed") == 0 && i + 1 < argc) {
+            gSeed = SDL_strtoull(args[++i], NULL, 10);
+        } else if (SDL_strcmp(args[i], "--record") == 0 && i + 1 < argc) {
+            gRecordPath = args[++i];
+        } else if (SDL_strcmp(args[i], "--play") == 0 && i + 1 < argc) {
+            gPlayPath = args[++i];
+            gHeadless = true;
+        } else if (SDL_strcmp(args[i], "--timings") == 0 && i + 1 < argc) {
+            gTimingsPath = args[++i];
+        } else if (SDL_strcmp(args[i], "--pack") == 0 && i + 1 < argc) {
+            gPackPath = args[++i];
+        } else if (SDL_strcmp(args[i], "--sweep") == 0 && i + 1 < argc) {
+            gSweepPath = args[++i];
+        } else if (SDL_strcmp(args[i], "--spawn-interval") == 0 && i + 1 < argc && parseSweepRange(args[i + 1], gSweep.spawnInterval)) {
+            ++i;
+        } else if (SDL_strcmp(args[i], "--change-interval") == 0 && i + 1 < argc && parseSweepRange(args[i + 1], gSweep.changeInterval)) {
+            ++i;
+        } else if (SDL_strcmp(args[i], "--attack-speed") == 0 && i + 1 < argc && parseSweepRange(args[i + 1], gSweep.attackSpeed)) {
+            ++i;
+        } else if (SDL_strcmp(args[i], "--speed-ramp") == 0 && i + 1 < argc && parseSweepRange(args[i + 1], gSweep.speedRamp)) {
+            ++i;
+        } else if (SDL_strcmp(args[i], "--runs") == 0 && i + 1 < argc) {
+            int runs = SDL_atoi(args[++i]);
+            gSweep.runs = SDL_max(runs, 1);
+        } else if (SDL_strcmp(args[i], "--threads") == 0 && i + 1 < argc) {
+            int threads = SDL_atoi(args[++i]);
+            gThreadCount = SDL_clamp(threads, 0, MAX_WORKERS);
+        } else if (SDL_strcmp(args[i], "--policy") == 0 && i + 1 < argc && parseBotPolicy(args[i + 1], gSweep.policy)) {
+            ++i;
+        } else if (SDL_strcmp(args[i], "--fps") == 0 && i + 1 < argc) {
+            int frameRate = SDL_atoi(args[++i]);
+            gTargetFrameRate = SDL_clamp(frameRate, 0, MAX_FRAME_RATE);
+        } else if (SDL_strcmp(args[i], "--render-scale") == 0 && i + 1 < argc) {
+            int percent = SDL_atoi(args[++i]);
+            gRenderScalePercent = SDL_clamp(percent, 0, 100);
+        } else if (SDL_strcmp(args[i], "--trace") == 0 && i + 1 < argc) {
+            gTracePath = args[++i];
+        } else if (SDL_strcmp(args[i], "--bot") == 0 && i + 1 < argc && parseBotPolicy(args[i + 1], gBotPolicy)) {
+            gBotPlays = true;
+            ++i;
+        } else if (SDL_strcmp(args[i], "--no-alloc") == 0) {
+            gCheckAllocations = true;
+        } else if (SDL_strcmp(args[i], "--bench") == 0) {
+            gBenchmark = true;
+            gHeadless = true;
+            gSeed = BENCH_SEED;
+        } else {
+            printf("Unknown argument %s!\n", args[i]);
+            printf("Usage: SGDODGE [--headless] [--ticks count] [--seed number] [--record file | --play file] [--bot idle|random|dodge|lookahead] [--threads count] [--fps rate] [--render-scale percent] [--timings file.csv] [--trace file.json] [--no-alloc] [--bench] [--pack bundle]\n");
+            printf("       SGDODGE --sweep out.csv [--spawn-interval ms[:max:step]] [--change-interval ms[:max:step]] [--attack-speed px/s[:max:step]]\n"
+                   "               [--speed-ramp factor[:max:step]] [--runs count] [--threads count] [--policy idle|random|dodge|lookahead] [--seed number] [--ticks cap] [--trace file.json]\n");
+            return false;
+        }
+    }
+    return true;
+}
+
 bool init() {
+    if (gHeadless) {
+        // Offscreen drivers, SDL_VIDEODRIVER / SDL_AUDIODRIVER (e.g. "disk") still take precedence
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+        SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_JOYSTICK) < 0) {
         printf("SDL could not iniialize! SDL_Error: %s\n", SDL_GetError());
         return false;
@@ -117,25 +904,76 @@ bool init() {
         printf("SDL_mixer could not iniialize! Mix_Error: %s\n", Mix_GetError());
         return false;
     }
+    if (gTracer.enabled) {
+        Mix_SetPostMix(traceAudioMix, NULL);
+    }
 
-    gWindow = SDL_CreateWindow("SGDODGE", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+    gWindow = SDL_CreateWindow("SGDODGE", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, gHeadless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN);
     if (gWindow == NULL) {
         printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
         return false;
     }
 
-    gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED);
+    // Headless runs as fast as possible, otherwise pace to --fps or the display's refresh rate
+    SDL_DisplayMode displayMode = {};
+    if (!gHeadless) {
+        SDL_GetWindowDisplayMode(gWindow, &displayMode);
+        initFramePacer(gPacer, gTargetFrameRate, displayMode.refresh_rate);
+    }
+
+    // The dummy video driver only offers the software renderer
+    gRenderer = SDL_CreateRenderer(gWindow, -1, gHeadless ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED | (gPacer.vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
     if (gRenderer == NULL) {
         printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
         return false;
     }
 
-    gFont = TTF_OpenFont("fonts/OpenSans-Regular.ttf", 28);
+    // A missing bundle is not an error, everything falls back to the loose files
+    openAssetBundle(gBundle, BUNDLE_PATH);
+
+    gFont = openFont(28);
     if (gFont == NULL) {
         printf("Failed to load font! TTF_Error: %s\n", TTF_GetError());
         return false;
     }
 
+    gHudFont = openFont(HUD_FONT_SIZE);
+    if (gHudFont == NULL) {
+        printf("Failed to load HUD font! TTF_Error: %s\n", TTF_GetError());
+        return false;
+    }
+
+    if (!buildGlyphAtlas(gTextGlyphs, gFont, TEXT_GLYPHS) || !buildGlyphAtlas(gHudGlyphs, gHudFont, TEXT_GLYPHS)) {
+        printf("Failed to build glyph atlas!\n");
+        return false;
+    }
+
+    if (SDL_RenderTargetSupported(gRenderer)) {
+        gGameOverTexture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+        if (gGameOverTexture == NULL) {
+            printf("Warning: Unable to create game over texture! SDL Error: %s\n", SDL_GetError());
+        }
+
+        // Same format as the window so stretching it up is the only conversion. Without it no
+        // scaled sprite atlases get built either.
+        if (drawsFrames()) {
+            gResolution.target = SDL_CreateTexture(gRenderer, SDL_GetWindowPixelFormat(gWindow), SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+            if (gResolution.target == NULL) {
+                printf("Warning: Unable to create scene texture! SDL Error: %s\n", SDL_GetError());
+            } else {
+                SDL_SetTextureScaleMode(gResolution.target, SDL_ScaleModeLinear);
+            }
+        }
+    }
+
+    // The benchmark measures full resolution unless asked otherwise, so its runs stay comparable
+    gResolution.scale = RENDER_SCALE_STEPS;
+    gResolution.pinned = gRenderScalePercent > 0 || gBenchmark;
+    if (gRenderScalePercent > 0) {
+        int scale = (gRenderScalePercent * RENDER_SCALE_STEPS + 50) / 100;
+        gResolution.scale = SDL_clamp(scale, MIN_RENDER_SCALE, RENDER_SCALE_STEPS);
+    }
+
     if( SDL_NumJoysticks() < 1 ){
         printf( "Warning: No joysticks connected!\n" );
     } else {
@@ -145,131 +983,740 @@ bool init() {
             }
         }
 
-    srand(static_cast<unsigned int>(time(NULL)));
     return true;
 }
 
-bool loadMedia(GameObject& player, SDL_Texture*& walkTexture, int& walkFrames, std::vector<SDL_Texture*>& attackTextures) {
-    player.texture = loadTexture("img/idle.bmp");
-    if (player.texture == NULL) {
-        printf("Failed to load idle texture!\n");
+// Starts the loader thread and keeps presenting a loading screen until the sprite atlas is ready.
+// The rest, currently only the music, keeps arriving through pumpAssetLoader() while playing.
+bool loadMedia(int& walkFrames, bool& quit) {
+    TraceScope trace("loadMedia");
+    if (!startAssetLoader(gLoader)) {
         return false;
     }
 
-    walkTexture = loadTexture("img/walking_sprite.bmp");
-    if (walkTexture == NULL) {
-        printf("Failed to load walk texture!\n");
-        return false;
+    while (gSprites.texture == NULL && !quit) {
+        if (!pumpAssetLoader(gLoader)) {
+            return false;
+        }
+        if (gSprites.texture != NULL) {
+            break;
+        }
+
+        if (gHeadless) {
+            SDL_Delay(1);
+            continue;
+        }
+        SDL_Event e;
+        while (SDL_PollEvent(&e) != 0) {
+            quit = quit || e.type == SDL_QUIT;
+        }
+        renderLoadingScreen(gLoader);
     }
+    walkFrames = gSprites.rects[SPRITE_WALK].w / PLAYER_SIZE;
+    return true;
+}
 
-    SDL_QueryTexture(walkTexture, NULL, NULL, &walkFrames, NULL);
-    walkFrames /= PLAYER_SIZE;
+// Loads every SPRITE_PATHS image and shelf-packs them, in table order, into one ARGB8888 surface.
+// Images are copied without blending so their alpha survives as is, attack images are stretched to
+// ATTACK_SIZE first so drawing them is a 1:1 copy. Returns NULL on failure.
+SDL_Surface* packSpriteSurface(SDL_Rect rects[SPRITE_COUNT], SDL_atomic_t* progress) {
+    SDL_Surface* surfaces[SPRITE_COUNT] = {};
+    bool success = true;
+    int atlasWidth = 0;
+    for (int i = 0; i < SPRITE_COUNT && success; ++i) {
+        surfaces[i] = SDL_LoadBMP(SPRITE_PATHS[i]);
+        if (surfaces[i] == NULL) {
+            printf("Unable to load image %s! SDL_Error: %s\n", SPRITE_PATHS[i], SDL_GetError());
+            success = false;
+        } else if (i >= SPRITE_ATTACK_FIRST && (surfaces[i]->w != ATTACK_SIZE || surfaces[i]->h != ATTACK_SIZE)) {
+            // Nearest neighbour, like the renderer's default scale quality used to draw them
+            SDL_Surface* stretched = SDL_CreateRGBSurfaceWithFormat(0, ATTACK_SIZE, ATTACK_SIZE, 32, surfaces[i]->format->format);
+            if (stretched == NULL || SDL_SoftStretch(surfaces[i], NULL, stretched, NULL) < 0) {
+                printf("Unable to stretch image %s! SDL_Error: %s\n", SPRITE_PATHS[i], SDL_GetError());
+                SDL_FreeSurface(stretched);
+                stretched = NULL;
+                success = false;
+            }
+            SDL_FreeSurface(surfaces[i]);
+            surfaces[i] = stretched;
+        }
+        if (surfaces[i] != NULL) {
+            atlasWidth = SDL_max(atlasWidth, surfaces[i]->w);
+            if (progress != NULL) {
+                SDL_AtomicIncRef(progress);
+            }
+        }
+    }
 
-    // Load attack textures
-    for (int i = 1; i <= 3; ++i) {
-        char path[32];
-        snprintf(path, sizeof(path), "img/attack%d.bmp", i);
-        SDL_Texture* attackTexture = loadTexture(path);
-        if (attackTexture == NULL) {
-            printf("Failed to load attack texture %s!\n", path);
-            return false;
+    SDL_Surface* atlasSurface = NULL;
+    if (success) {
+        // Rows are as tall as their tallest sprite and wrap when the next one would not fit
+        int penX = 0, penY = 0, rowHeight = 0;
+        for (int i = 0; i < SPRITE_COUNT; ++i) {
+            if (penX + surfaces[i]->w > atlasWidth) {
+                penX = 0;
+                penY += rowHeight + SPRITE_ATLAS_PADDING;
+                rowHeight = 0;
+            }
+            rects[i] = { penX, penY, surfaces[i]->w, surfaces[i]->h };
+            penX += surfaces[i]->w + SPRITE_ATLAS_PADDING;
+            rowHeight = SDL_max(rowHeight, surfaces[i]->h);
+        }
+
+        atlasSurface = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, penY + rowHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (atlasSurface == NULL) {
+            printf("Unable to create sprite atlas surface! SDL Error: %s\n", SDL_GetError());
+            success = false;
         }
-        attackTextures.push_back(attackTexture);
     }
 
-    // Load background texture
-    gBackgroundTexture = loadTexture("img/grass.bmp");
-    if (gBackgroundTexture == NULL) {
-        printf("Failed to load background texture!\n");
-        return false;
+    for (int i = 0; i < SPRITE_COUNT && success; ++i) {
+        SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+        if (SDL_BlitSurface(surfaces[i], NULL, atlasSurface, &rects[i]) < 0) {
+            printf("Unable to pack %s into the sprite atlas! SDL Error: %s\n", SPRITE_PATHS[i], SDL_GetError());
+            success = false;
+        }
     }
 
-    // Load background music
-    gBackgroundMusic = Mix_LoadMUS("audio/backgroundMusic.mp3");
-    if (gBackgroundMusic == NULL) {
-        printf("Failed to load background music! Mix_Error: %s\n", Mix_GetError());
-        return false;
+    for (int i = 0; i < SPRITE_COUNT; ++i) {
+        SDL_FreeSurface(surfaces[i]);
+    }
+    if (!success) {
+        SDL_FreeSurface(atlasSurface);
+        return NULL;
     }
+    return atlasSurface;
+}
 
+// Uploads a sprite atlas packed from the loose image files by packSpriteSurface()
+bool createSpriteAtlas(SpriteAtlas& atlas, SDL_Surface* atlasSurface, const SDL_Rect rects[SPRITE_COUNT]) {
+    SDL_memcpy(atlas.rects, rects, sizeof(atlas.rects));
+    atlas.texture = SDL_CreateTextureFromSurface(gRenderer, atlasSurface);
+    if (atlas.texture == NULL) {
+        printf("Unable to create sprite atlas texture! SDL Error: %s\n", SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureBlendMode(atlas.texture, SDL_BLENDMODE_BLEND);
+    createScaledSprites(atlas, atlasSurface);
+    createBackgrounds(atlas, atlasSurface);
     return true;
 }
 
-SDL_Texture* loadTexture(const char* path) {
-    SDL_Texture* newTexture = NULL;
-    SDL_Surface* loadedSurface = SDL_LoadBMP(path);
-    if (loadedSurface == NULL) {
-        printf("Unable to load image %s! SDL_Error: %s\n", path, SDL_GetError());
+// Creates the sprite atlas texture straight from the bundle's pixels. When the renderer takes the
+// bundle's pixel format they are uploaded as is, otherwise SDL converts them once from the mapping.
+bool createSpriteAtlasFromBundle(SpriteAtlas& atlas, const AssetBundle& bundle) {
+    const BundleHeader* header = (const BundleHeader*)bundle.data;
+    Uint32 format = SDL_SwapLE32(header->atlasFormat);
+    int width = SDL_SwapLE32(header->atlasWidth);
+    int height = SDL_SwapLE32(header->atlasHeight);
+    int pitch = SDL_SwapLE32(header->atlasPitch);
+    void* pixels = (void*)(bundle.data + SDL_SwapLE32(header->chunkOffset[BUNDLE_ATLAS_PIXELS]));
+    for (int i = 0; i < SPRITE_COUNT; ++i) {
+        atlas.rects[i] = { (int)SDL_SwapLE32(header->spriteRects[i][0]), (int)SDL_SwapLE32(header->spriteRects[i][1]),
+                           (int)SDL_SwapLE32(header->spriteRects[i][2]), (int)SDL_SwapLE32(header->spriteRects[i][3]) };
+    }
+
+    bool nativeFormat = false;
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(gRenderer, &info) == 0) {
+        for (Uint32 i = 0; i < info.num_texture_formats; ++i) {
+            nativeFormat = nativeFormat || info.texture_formats[i] == format;
+        }
+    }
+
+    if (nativeFormat) {
+        atlas.texture = SDL_CreateTexture(gRenderer, format, SDL_TEXTUREACCESS_STATIC, width, height);
+        if (atlas.texture != NULL && SDL_UpdateTexture(atlas.texture, NULL, pixels, pitch) < 0) {
+            SDL_DestroyTexture(atlas.texture);
+            atlas.texture = NULL;
+        }
     } else {
-        newTexture = SDL_CreateTextureFromSurface(gRenderer, loadedSurface);
-        if (newTexture == NULL) {
-            printf("Unable to create texture from %s! SDL_Error: %s\n", path, SDL_GetError());
+        SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, width, height, SDL_BITSPERPIXEL(format), pitch, format);
+        if (surface != NULL) {
+            atlas.texture = SDL_CreateTextureFromSurface(gRenderer, surface);
+            SDL_FreeSurface(surface);
         }
-        SDL_FreeSurface(loadedSurface);
     }
-    return newTexture;
+
+    if (atlas.texture == NULL) {
+        printf("Unable to create sprite atlas texture from bundle! SDL Error: %s\n", SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureBlendMode(atlas.texture, SDL_BLENDMODE_BLEND);
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, width, height, SDL_BITSPERPIXEL(format), pitch, format);
+    createScaledSprites(atlas, surface);
+    createBackgrounds(atlas, surface);
+    SDL_FreeSurface(surface);
+    return true;
 }
 
-SDL_Texture* renderText(const std::string &message, SDL_Color color) {
-    SDL_Surface* textSurface = TTF_RenderText_Solid(gFont, message.c_str(), color);
-    if (textSurface == NULL) {
-        printf("Unable to render text surface! SDL_ttf Error: %s\n", TTF_GetError());
-        return NULL;
-    } else {
-        SDL_Texture* textTexture = SDL_CreateTextureFromSurface(gRenderer, textSurface);
-        if (textTexture == NULL) {
-            printf("Unable to create texture from rendered text! SDL Error: %s\n", SDL_GetError());
+// Shrinks every sprite once per scene scale, so drawing into the scaled scene target copies
+// sprites 1:1 instead of stretching each one. The software renderer's stretched blits cost more
+// than the pixels they save. That only holds when the atlas already has sprites at the size they
+// are drawn, which packSpriteSurface() makes sure of. Without these the scene stays at full resolution.
+void createScaledSprites(SpriteAtlas& atlas, SDL_Surface* atlasSurface) {
+    if (gResolution.target == NULL) {
+        return;
+    }
+
+    bool success = atlasSurface != NULL;
+    for (int i = SPRITE_ATTACK_FIRST; i < SPRITE_COUNT && success; ++i) {
+        if (atlas.rects[i].w != ATTACK_SIZE || atlas.rects[i].h != ATTACK_SIZE) {
+            SDL_SetError("Attack sprites are not packed at %d pixels", ATTACK_SIZE);
+            success = false;
+        }
+    }
+    for (int scale = MIN_RENDER_SCALE; scale < RENDER_SCALE_STEPS && success; ++scale) {
+        SDL_Rect size = scaleRect({ 0, 0, atlasSurface->w, atlasSurface->h }, scale);
+        SDL_Surface* scaled = SDL_CreateRGBSurfaceWithFormat(0, size.w, size.h, 32, atlasSurface->format->format);
+        success = scaled != NULL;
+        for (int i = 0; i < SPRITE_COUNT && success; ++i) {
+            SDL_Rect destination = scaleRect(atlas.rects[i], scale);
+            success = SDL_SoftStretchLinear(atlasSurface, &atlas.rects[i], scaled, &destination) == 0;
+        }
+        if (success) {
+            atlas.scaled[scale] = SDL_CreateTextureFromSurface(gRenderer, scaled);
+            success = atlas.scaled[scale] != NULL;
+        }
+        if (success) {
+            SDL_SetTextureBlendMode(atlas.scaled[scale], SDL_BLENDMODE_BLEND);
+        }
+        SDL_FreeSurface(scaled);
+    }
+
+    if (!success) {
+        printf("Warning: Unable to create scaled sprites, the scene stays at full resolution! SDL Error: %s\n", SDL_GetError());
+        for (int scale = 0; scale < RENDER_SCALE_STEPS; ++scale) {
+            SDL_DestroyTexture(atlas.scaled[scale]);
+            atlas.scaled[scale] = NULL;
         }
-        SDL_FreeSurface(textSurface);
-        return textTexture;
+        SDL_DestroyTexture(gResolution.target);
+        gResolution.target = NULL;
     }
 }
 
-void close(std::vector<SDL_Texture*>& attackTextures) {
-    for (SDL_Texture* texture : attackTextures) {
-        SDL_DestroyTexture(texture);
+// Resolves the background sprite once into textures exactly the scene's size, in the window's
+// pixel format and without alpha, so every frame copies rows instead of stretching and blending
+// the sprite over the whole screen. Missing ones fall back to stretching from the atlas.
+void createBackgrounds(SpriteAtlas& atlas, SDL_Surface* atlasSurface) {
+    if (!drawsFrames()) {
+        return;
+    }
+    if (atlasSurface == NULL) {
+        return;
     }
 
-    SDL_DestroyTexture(gBackgroundTexture);
-    SDL_DestroyRenderer(gRenderer);
-    SDL_DestroyWindow(gWindow);
-    TTF_CloseFont(gFont);
-    Mix_FreeMusic(gBackgroundMusic);
-    SDL_JoystickClose( gGameController );
-    gGameController = NULL;
-    gBackgroundTexture = NULL;
-    gRenderer = NULL;
-    gWindow = NULL;
-    gFont = NULL;
-    gBackgroundMusic = NULL;
+    Uint32 format = SDL_GetWindowPixelFormat(gWindow);
+    if (SDL_BYTESPERPIXEL(format) != 4 || SDL_ISPIXELFORMAT_ALPHA(format)) {
+        format = SDL_PIXELFORMAT_RGB888;
+    }
+    const SDL_Rect& rect = atlas.rects[SPRITE_BACKGROUND];
+    SDL_Surface* sprite = SDL_CreateRGBSurfaceWithFormat(0, rect.w, rect.h, 32, format);
+    SDL_SetSurfaceBlendMode(atlasSurface, SDL_BLENDMODE_NONE);
+    if (sprite == NULL || SDL_BlitSurface(atlasSurface, &rect, sprite, NULL) < 0) {
+        printf("Warning: Unable to convert the background! SDL Error: %s\n", SDL_GetError());
+        SDL_FreeSurface(sprite);
+        return;
+    }
 
-    Mix_Quit();
-    TTF_Quit();
-    SDL_Quit();
+    // Only the full size one unless the scene can be drawn at a lower resolution
+    int minScale = gResolution.target != NULL ? MIN_RENDER_SCALE : RENDER_SCALE_STEPS;
+    for (int scale = minScale; scale <= RENDER_SCALE_STEPS; ++scale) {
+        SDL_Rect size = scaleRect({ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT }, scale);
+        SDL_Surface* stretched = SDL_CreateRGBSurfaceWithFormat(0, size.w, size.h, 32, format);
+        if (stretched != NULL && SDL_SoftStretchLinear(sprite, NULL, stretched, NULL) == 0) {
+            atlas.backgrounds[scale] = SDL_CreateTexture(gRenderer, format, SDL_TEXTUREACCESS_STATIC, size.w, size.h);
+            if (atlas.backgrounds[scale] != NULL && SDL_UpdateTexture(atlas.backgrounds[scale], NULL, stretched->pixels, stretched->pitch) < 0) {
+                SDL_DestroyTexture(atlas.backgrounds[scale]);
+                atlas.backgrounds[scale] = NULL;
+            }
+        }
+        if (atlas.backgrounds[scale] == NULL) {
+            printf("Warning: Unable to create background texture! SDL Error: %s\n", SDL_GetError());
+        } else {
+            SDL_SetTextureBlendMode(atlas.backgrounds[scale], SDL_BLENDMODE_NONE);
+        }
+        SDL_FreeSurface(stretched);
+    }
+    SDL_FreeSurface(sprite);
 }
 
-void handleEvents(bool& quit, GameObject& player, bool& gameOver, int& startTime, std::vector<GameObject>& attacks) {
-    SDL_Event e;
-    while (SDL_PollEvent(&e) != 0) {
-        if (e.type == SDL_QUIT) {
-            quit = true;
-        } else if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
-            bool isKeyDown = (e.type == SDL_KEYDOWN);
+// Offline packer: writes the sprite atlas pixels, the font and the music into one bundle file.
+// Music is optional, without it the bundle gets an empty music chunk and the game plays silently.
+bool packAssets(const char* path) {
+    BundleHeader header = {};
+    SDL_Rect rects[SPRITE_COUNT];
+    SDL_Surface* atlasSurface = packSpriteSurface(rects, NULL);
+    if (atlasSurface == NULL) {
+        return false;
+    }
 
-            switch (e.key.keysym.sym) {
-                case SDLK_UP:
-                    player.velY = isKeyDown ? -5 : 0;
+    size_t fontSize = 0, musicSize = 0;
+    void* font = SDL_LoadFile(FONT_PATH, &fontSize);
+    void* music = SDL_LoadFile(MUSIC_PATH, &musicSize);
+    const void* chunks[BUNDLE_CHUNK_COUNT] = { atlasSurface->pixels, font, music };
+    size_t sizes[BUNDLE_CHUNK_COUNT] = { (size_t)atlasSurface->pitch * atlasSurface->h, fontSize, musicSize };
+
+    bool success = font != NULL;
+    if (!success) {
+        printf("Unable to read %s! SDL Error: %s\n", FONT_PATH, SDL_GetError());
+    } else if (music == NULL) {
+        printf("Warning: Unable to read %s, the bundle will have no music! SDL Error: %s\n", MUSIC_PATH, SDL_GetError());
+        sizes[BUNDLE_MUSIC] = 0;
+    }
+
+    header.magic = SDL_SwapLE32(BUNDLE_MAGIC);
+    header.version = SDL_SwapLE32(BUNDLE_VERSION);
+    header.atlasFormat = SDL_SwapLE32(atlasSurface->format->format);
+    header.atlasWidth = SDL_SwapLE32(atlasSurface->w);
+    header.atlasHeight = SDL_SwapLE32(atlasSurface->h);
+    header.atlasPitch = SDL_SwapLE32(atlasSurface->pitch);
+    for (int i = 0; i < SPRITE_COUNT; ++i) {
+        header.spriteRects[i][0] = SDL_SwapLE32(rects[i].x);
+        header.spriteRects[i][1] = SDL_SwapLE32(rects[i].y);
+        header.spriteRects[i][2] = SDL_SwapLE32(rects[i].w);
+        header.spriteRects[i][3] = SDL_SwapLE32(rects[i].h);
+    }
+    Uint32 offset = sizeof(header);
+    for (int i = 0; i < BUNDLE_CHUNK_COUNT; ++i) {
+        offset = (offset + BUNDLE_ALIGNMENT - 1) & ~(BUNDLE_ALIGNMENT - 1);
+        header.chunkOffset[i] = SDL_SwapLE32(offset);
+        header.chunkSize[i] = SDL_SwapLE32((Uint32)sizes[i]);
+        offset += (Uint32)sizes[i];
+    }
+
+    SDL_RWops* file = success ? SDL_RWFromFile(path, "wb") : NULL;
+    if (success && file == NULL) {
+        printf("Unable to create asset bundle %s! SDL Error: %s\n", path, SDL_GetError());
+        success = false;
+    }
+    if (success) {
+        const Uint8 zeros[BUNDLE_ALIGNMENT] = {};
+        success = SDL_RWwrite(file, &header, sizeof(header), 1) == 1;
+        for (int i = 0; i < BUNDLE_CHUNK_COUNT && success; ++i) {
+            size_t padding = SDL_SwapLE32(header.chunkOffset[i]) - SDL_RWtell(file);
+            success = (padding == 0 || SDL_RWwrite(file, zeros, padding, 1) == 1) && (sizes[i] == 0 || SDL_RWwrite(file, chunks[i], sizes[i], 1) == 1);
+        }
+        if (SDL_RWclose(file) < 0 || !success) {
+            printf("Unable to write asset bundle %s! SDL Error: %s\n", path, SDL_GetError());
+            success = false;
+        }
+    }
+
+    if (success) {
+        printf("Packed %d sprites (%dx%d atlas), %s and %s into %s, %u bytes\n",
+               SPRITE_COUNT, atlasSurface->w, atlasSurface->h, FONT_PATH, music != NULL ? MUSIC_PATH : "no music", path, offset);
+    }
+    SDL_free(font);
+    SDL_free(music);
+    SDL_FreeSurface(atlasSurface);
+    return success;
+}
+
+// Maps the bundle read-only. Returns false and leaves the bundle empty if the file is missing
+// or doesn't match this build, in which case assets are loaded from the loose files.
+bool openAssetBundle(AssetBundle& bundle, const char* path) {
+    bundle = {};
+#ifdef HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            bundle.data = (const Uint8*)data;
+            bundle.size = (size_t)info.st_size;
+            bundle.mapped = true;
+        }
+    }
+    close(fd);
+#else
+    bundle.data = (const Uint8*)SDL_LoadFile(path, &bundle.size);
+#endif
+    if (bundle.data == NULL) {
+        return false;
+    }
+
+    const BundleHeader* header = (const BundleHeader*)bundle.data;
+    bool valid = bundle.size >= sizeof(BundleHeader) && SDL_SwapLE32(header->magic) == BUNDLE_MAGIC && SDL_SwapLE32(header->version) == BUNDLE_VERSION;
+    for (int i = 0; i < BUNDLE_CHUNK_COUNT && valid; ++i) {
+        valid = SDL_SwapLE32(header->chunkOffset[i]) <= bundle.size && SDL_SwapLE32(header->chunkSize[i]) <= bundle.size - SDL_SwapLE32(header->chunkOffset[i]);
+    }
+    valid = valid && (size_t)SDL_SwapLE32(header->atlasPitch) * SDL_SwapLE32(header->atlasHeight) <= SDL_SwapLE32(header->chunkSize[BUNDLE_ATLAS_PIXELS]);
+    if (!valid) {
+        printf("Warning: Ignoring asset bundle %s, it is damaged or from another version\n", path);
+        closeAssetBundle(bundle);
+        return false;
+    }
+    return true;
+}
+
+void closeAssetBundle(AssetBundle& bundle) {
+#ifdef HAVE_MMAP
+    if (bundle.mapped) {
+        munmap((void*)bundle.data, bundle.size);
+    }
+#endif
+    if (!bundle.mapped) {
+        SDL_free((void*)bundle.data);
+    }
+    bundle = {};
+}
+
+// Read-only stream over one chunk of the mapping, for the SDL_ttf and SDL_mixer *_RW loaders
+SDL_RWops* openBundleChunk(const AssetBundle& bundle, BundleChunk chunk) {
+    const BundleHeader* header = (const BundleHeader*)bundle.data;
+    return SDL_RWFromConstMem(bundle.data + SDL_SwapLE32(header->chunkOffset[chunk]), SDL_SwapLE32(header->chunkSize[chunk]));
+}
+
+TTF_Font* openFont(int size) {
+    if (gBundle.data != NULL) {
+        return TTF_OpenFontRW(openBundleChunk(gBundle, BUNDLE_FONT), 1, size);
+    }
+    return TTF_OpenFont(FONT_PATH, size);
+}
+
+bool startAssetLoader(AssetLoader& loader) {
+    loader = {};
+    loader.lock = SDL_CreateMutex();
+    if (loader.lock == NULL) {
+        printf("Unable to create asset loader lock! SDL Error: %s\n", SDL_GetError());
+        return false;
+    }
+    loader.thread = SDL_CreateThread(assetLoaderThread, "asset loader", &loader);
+    if (loader.thread == NULL) {
+        printf("Unable to create asset loader thread! SDL Error: %s\n", SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+// Loader thread: only file I/O and decoding happens here, nothing touches the renderer.
+// Items are posted in order of importance so the game can start before the music is probed.
+int assetLoaderThread(void* data) {
+    AssetLoader& loader = *(AssetLoader*)data;
+    traceThread("asset loader");
+    static const char* const ITEM_NAMES[LOAD_ITEM_COUNT] = { "decode sprite atlas", "decode music" };
+    for (int i = 0; i < LOAD_ITEM_COUNT; ++i) {
+        TraceScope trace(ITEM_NAMES[i]);
+        LoadedAsset asset = {};
+        asset.item = (LoadItem)i;
+        if (asset.item == LOAD_SPRITE_ATLAS && gBundle.data != NULL) {
+            // Already packed and converted, fault the pixels in here so the upload doesn't wait on disk
+            const BundleHeader* header = (const BundleHeader*)gBundle.data;
+            const Uint8* pixels = gBundle.data + SDL_SwapLE32(header->chunkOffset[BUNDLE_ATLAS_PIXELS]);
+            volatile Uint8 sink = 0;
+            for (Uint32 offset = 0; offset < SDL_SwapLE32(header->chunkSize[BUNDLE_ATLAS_PIXELS]); offset += 4096) {
+                sink += pixels[offset];
+            }
+            SDL_AtomicAdd(&loader.progress, SPRITE_COUNT);
+        } else if (asset.item == LOAD_SPRITE_ATLAS) {
+            asset.surface = packSpriteSurface(asset.rects, &loader.progress);
+            asset.failed = asset.surface == NULL;
+        } else if (asset.item == LOAD_MUSIC) {
+            const BundleHeader* header = (const BundleHeader*)gBundle.data;
+            if (header != NULL && SDL_SwapLE32(header->chunkSize[BUNDLE_MUSIC]) == 0) {
+                // Packed without music, nothing to play
+                asset.failed = true;
+            } else if (gBundle.data != NULL) {
+                asset.music = Mix_LoadMUS_RW(openBundleChunk(gBundle, BUNDLE_MUSIC), 1);
+            } else {
+                asset.music = Mix_LoadMUS(MUSIC_PATH);
+            }
+            if (asset.music == NULL && !asset.failed) {
+                printf("Failed to load background music! Mix_Error: %s\n", Mix_GetError());
+                asset.failed = true;
+            }
+            SDL_AtomicIncRef(&loader.progress);
+        }
+
+        SDL_LockMutex(loader.lock);
+        loader.queue[loader.queued++] = asset;
+        SDL_UnlockMutex(loader.lock);
+    }
+    return 0;
+}
+
+// Main thread side of the queue: creates textures for everything the loader has finished and
+// starts the music. Returns false only when the sprite atlas failed, music is optional.
+bool pumpAssetLoader(AssetLoader& loader) {
+    SDL_LockMutex(loader.lock);
+    int queued = loader.queued;
+    SDL_UnlockMutex(loader.lock);
+
+    bool success = true;
+    for (; loader.received < queued; ++loader.received) {
+        LoadedAsset& asset = loader.queue[loader.received];
+        if (asset.item == LOAD_SPRITE_ATLAS) {
+            if (asset.failed) {
+                printf("Failed to build sprite atlas!\n");
+                success = false;
+            } else if (asset.surface != NULL) {
+                TraceScope trace("upload sprite atlas");
+                success = createSpriteAtlas(gSprites, asset.surface, asset.rects);
+            } else {
+                success = createSpriteAtlasFromBundle(gSprites, gBundle);
+            }
+            if (success && drawsFrames()) {
+                reserveRenderQueue(gSprites.texture);
+            }
+            SDL_FreeSurface(asset.surface);
+            asset.surface = NULL;
+        } else if (asset.item == LOAD_MUSIC && !asset.failed) {
+            gBackgroundMusic = asset.music;
+            asset.music = NULL;
+            if (Mix_PlayingMusic() == 0) {
+                Mix_PlayMusic(gBackgroundMusic, -1);
+            }
+        }
+    }
+
+    if (loader.received == LOAD_ITEM_COUNT && loader.thread != NULL) {
+        SDL_WaitThread(loader.thread, NULL);
+        loader.thread = NULL;
+    }
+    return success;
+}
+
+// SDL queues a command and vertices per copy and keeps them for reuse after a flush, but only grows
+// them when a frame draws more copies than any before. Queue a full frame's worth once so a rising
+// attack count does not allocate mid-game. 1x1 copies keep the flush cheap.
+void reserveRenderQueue(SDL_Texture* texture) {
+    SDL_Rect pixel = { 0, 0, 1, 1 };
+    for (int i = 0; i < RENDER_QUEUE_RESERVE; ++i) {
+        SDL_RenderCopy(gRenderer, texture, &pixel, &pixel);
+    }
+    SDL_RenderFlush(gRenderer);
+}
+
+// Joins the loader and frees whatever it produced that was never received
+void finishAssetLoader(AssetLoader& loader) {
+    if (loader.thread != NULL) {
+        SDL_WaitThread(loader.thread, NULL);
+        loader.thread = NULL;
+    }
+    for (int i = loader.received; i < loader.queued; ++i) {
+        SDL_FreeSurface(loader.queue[i].surface);
+        Mix_FreeMusic(loader.queue[i].music);
+    }
+    loader.received = loader.queued;
+    SDL_DestroyMutex(loader.lock);
+    loader.lock = NULL;
+}
+
+void renderLoadingScreen(const AssetLoader& loader) {
+    SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
+    SDL_RenderClear(gRenderer);
+
+    SDL_Rect barRect = { (SCREEN_WIDTH - LOADING_BAR_WIDTH) / 2, (SCREEN_HEIGHT - LOADING_BAR_HEIGHT) / 2, LOADING_BAR_WIDTH, LOADING_BAR_HEIGHT };
+    renderGlyphText(gHudGlyphs, "Loading...", barRect.x, barRect.y - HUD_FONT_SIZE * 2);
+    SDL_Rect fillRect = barRect;
+    fillRect.w = LOADING_BAR_WIDTH * SDL_AtomicGet((SDL_atomic_t*)&loader.progress) / LOAD_PROGRESS_STEPS;
+    SDL_SetRenderDrawColor(gRenderer, RESTART_BUTTON_COLOR.r, RESTART_BUTTON_COLOR.g, RESTART_BUTTON_COLOR.b, RESTART_BUTTON_COLOR.a);
+    SDL_RenderFillRect(gRenderer, &fillRect);
+    SDL_SetRenderDrawColor(gRenderer, TEXT_COLOR.r, TEXT_COLOR.g, TEXT_COLOR.b, TEXT_COLOR.a);
+    SDL_RenderDrawRect(gRenderer, &barRect);
+    SDL_RenderPresent(gRenderer);
+}
+
+// Renders every character once, side by side, into a single texture so frequently changing
+// text can be drawn from sub-rects without touching SDL_ttf again.
+bool buildGlyphAtlas(GlyphAtlas& atlas, TTF_Font* font, const char* characters) {
+    int atlasWidth = 0;
+    int atlasHeight = TTF_FontHeight(font);
+    for (const char* c = characters; *c; ++c) {
+        char glyph[2] = { *c, 0 };
+        int w, h;
+        if (TTF_SizeText(font, glyph, &w, &h) < 0) {
+            printf("Unable to measure glyph %s! SDL_ttf Error: %s\n", glyph, TTF_GetError());
+            return false;
+        }
+        atlas.rects[(int)*c] = { atlasWidth, 0, w, h };
+        atlasWidth += w;
+    }
+
+    SDL_Surface* atlasSurface = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, atlasHeight, 32, SDL_PIXELFORMAT_RGBA32);
+    if (atlasSurface == NULL) {
+        printf("Unable to create glyph atlas surface! SDL Error: %s\n", SDL_GetError());
+        return false;
+    }
+
+    for (const char* c = characters; *c; ++c) {
+        char glyph[2] = { *c, 0 };
+        SDL_Surface* glyphSurface = TTF_RenderText_Solid(font, glyph, TEXT_COLOR);
+        if (glyphSurface == NULL) {
+            printf("Unable to render glyph %s! SDL_ttf Error: %s\n", glyph, TTF_GetError());
+            SDL_FreeSurface(atlasSurface);
+            return false;
+        }
+        SDL_Rect destRect = atlas.rects[(int)*c];
+        SDL_BlitSurface(glyphSurface, NULL, atlasSurface, &destRect);
+        SDL_FreeSurface(glyphSurface);
+    }
+
+    atlas.texture = SDL_CreateTextureFromSurface(gRenderer, atlasSurface);
+    SDL_FreeSurface(atlasSurface);
+    if (atlas.texture == NULL) {
+        printf("Unable to create glyph atlas texture! SDL Error: %s\n", SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+// Draws text from the glyph atlas and returns its width, characters missing from the atlas are skipped
+int renderGlyphText(const GlyphAtlas& atlas, const char* text, int x, int y) {
+    int penX = x;
+    for (const char* c = text; *c; ++c) {
+        const SDL_Rect& srcRect = atlas.rects[*c & 0x7f];
+        SDL_Rect destRect = { penX, y, srcRect.w, srcRect.h };
+        SDL_RenderCopy(gRenderer, atlas.texture, &srcRect, &destRect);
+        penX += srcRect.w;
+    }
+    return penX - x;
+}
+
+int measureGlyphText(const GlyphAtlas& atlas, const char* text) {
+    int width = 0;
+    for (const char* c = text; *c; ++c) {
+        width += atlas.rects[*c & 0x7f].w;
+    }
+    return width;
+}
+
+void* SDLCALL countingMalloc(size_t size) {
+    SDL_AtomicIncRef(&gSdlAllocationCount);
+    gThreadAllocations++;
+    return gSdlMalloc(size);
+}
+
+void* SDLCALL countingCalloc(size_t count, size_t size) {
+    SDL_AtomicIncRef(&gSdlAllocationCount);
+    gThreadAllocations++;
+    return gSdlCalloc(count, size);
+}
+
+void* SDLCALL countingRealloc(void* memory, size_t size) {
+    SDL_AtomicIncRef(&gSdlAllocationCount);
+    gThreadAllocations++;
+    return gSdlRealloc(memory, size);
+}
+
+// Routes SDL, SDL_ttf and SDL_mixer allocations through counters so frames can be checked
+// for heap traffic, frees pass straight through
+void installCountingAllocator() {
+    SDL_GetOriginalMemoryFunctions(&gSdlMalloc, &gSdlCalloc, &gSdlRealloc, &gSdlFree);
+    if (SDL_SetMemoryFunctions(countingMalloc, countingCalloc, countingRealloc, gSdlFree) < 0) {
+        printf("Warning: Unable to install counting allocator! SDL Error: %s\n", SDL_GetError());
+    }
+}
+
+void resetFrameArena() {
+    gFrameArena.used = 0;
+}
+
+// Formats into the frame arena, the text stays valid until the next resetFrameArena() and is
+// truncated once the arena runs out
+const char* frameFormat(const char* format, ...) {
+    int available = FRAME_ARENA_SIZE - gFrameArena.used;
+    if (available <= 1) {
+        return "";
+    }
+
+    char* text = gFrameArena.buffer + gFrameArena.used;
+    va_list args;
+    va_start(args, format);
+    int length = SDL_vsnprintf(text, available, format, args);
+    va_end(args);
+    gFrameArena.used += SDL_min(length, available - 1) + 1;
+    return text;
+}
+
+void close() {
+    finishAssetLoader(gLoader);
+    closeTrace();
+    if (gJobs != NULL) {
+        stopJobSystem(*gJobs);
+        delete gJobs;
+        gJobs = NULL;
+        gAttackJobs = NULL;
+    }
+    SDL_DestroyTexture(gSprites.texture);
+    for (int scale = 0; scale < RENDER_SCALE_STEPS; ++scale) {
+        SDL_DestroyTexture(gSprites.scaled[scale]);
+        gSprites.scaled[scale] = NULL;
+    }
+    for (int scale = 0; scale <= RENDER_SCALE_STEPS; ++scale) {
+        SDL_DestroyTexture(gSprites.backgrounds[scale]);
+        gSprites.backgrounds[scale] = NULL;
+    }
+    SDL_DestroyTexture(gTextGlyphs.texture);
+    SDL_DestroyTexture(gHudGlyphs.texture);
+    SDL_DestroyTexture(gGameOverTexture);
+    SDL_DestroyTexture(gResolution.target);
+    SDL_DestroyRenderer(gRenderer);
+    SDL_DestroyWindow(gWindow);
+    TTF_CloseFont(gFont);
+    TTF_CloseFont(gHudFont);
+    Mix_FreeMusic(gBackgroundMusic);
+    closeAssetBundle(gBundle); // fonts and music read from the mapping until they are closed
+    SDL_JoystickClose( gGameController );
+    gGameController = NULL;
+    gSprites.texture = NULL;
+    gTextGlyphs.texture = NULL;
+    gHudGlyphs.texture = NULL;
+    gGameOverTexture = NULL;
+    gResolution.target = NULL;
+    gRenderer = NULL;
+    gWindow = NULL;
+    gFont = NULL;
+    gHudFont = NULL;
+    gBackgroundMusic = NULL;
+
+    Mix_Quit();
+    TTF_Quit();
+    SDL_Quit();
+}
+
+void handleEvents(bool& quit, World& world) {
+    GameObject& player = world.player;
+    SDL_Event e;
+    while (SDL_PollEvent(&e) != 0) {
+        if (e.type == SDL_QUIT) {
+            quit = true;
+        } else if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET) {
+            // Render target contents were lost, bake the game-over screen again
+            gGameOverTextureTime = -1;
+        } else if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
+            bool isKeyDown = (e.type == SDL_KEYDOWN);
+
+            switch (e.key.keysym.sym) {
+                case SDLK_UP:
+                    player.velY = isKeyDown ? -PLAYER_SPEED : 0;
                     break;
                 case SDLK_DOWN:
-                    player.velY = isKeyDown ? 5 : 0;
+                    player.velY = isKeyDown ? PLAYER_SPEED : 0;
                     break;
                 case SDLK_LEFT:
-                    player.velX = isKeyDown ? -5 : 0;
+                    player.velX = isKeyDown ? -PLAYER_SPEED : 0;
                     player.flip = SDL_FLIP_NONE;
                     break;
                 case SDLK_RIGHT:
-                    player.velX = isKeyDown ? 5 : 0;
+                    player.velX = isKeyDown ? PLAYER_SPEED : 0;
                     player.flip = SDL_FLIP_HORIZONTAL;
                     break;
+                case SDLK_F3:
+                    if (isKeyDown && !e.key.repeat) {
+                        gTimings.hudVisible = !gTimings.hudVisible;
+                    }
+                    break;
+                case SDLK_F4:
+                    if (isKeyDown && !e.key.repeat && gTracer.enabled && writeTrace(gTracePath)) {
+                        printf("Wrote trace to %s\n", gTracePath);
+                    }
+                    break;
             }
         } else if( e.type == SDL_JOYAXISMOTION ){
             //Motion on controller 0
@@ -278,12 +1725,12 @@ void handleEvents(bool& quit, GameObject& player, bool& gameOver, int& startTime
                 if( e.jaxis.axis == 0 ){
                     //Left of dead zone
                     if( e.jaxis.value < -JOYSTICK_DEAD_ZONE ){
-                        player.velX = -5;
+                        player.velX = -PLAYER_SPEED;
                         player.flip = SDL_FLIP_NONE;
                     }
                     //Right of dead zone
                     else if( e.jaxis.value > JOYSTICK_DEAD_ZONE ){
-                        player.velX = 5;
+                        player.velX = PLAYER_SPEED;
                         player.flip = SDL_FLIP_HORIZONTAL;
                     }
                     else{
@@ -292,38 +1739,37 @@ void handleEvents(bool& quit, GameObject& player, bool& gameOver, int& startTime
                     } else if( e.jaxis.axis == 1 ){
                         //Below of dead zone
                         if( e.jaxis.value < -JOYSTICK_DEAD_ZONE ){
-                            player.velY = -5;
+                            player.velY = -PLAYER_SPEED;
                         }
                         //Above of dead zone
                         else if( e.jaxis.value > JOYSTICK_DEAD_ZONE ){
-                            player.velY = 5;
+                            player.velY = PLAYER_SPEED;
                         }
                         else{
                             player.velY = 0;
                         }
                     }
                 }
-            }else if (gameOver && e.type == SDL_MOUSEBUTTONDOWN) {
+            }else if (world.gameOver && e.type == SDL_MOUSEBUTTONDOWN) {
             int x, y;
             SDL_GetMouseState(&x, &y);
             if (x > (SCREEN_WIDTH / 2 - 50) && x < (SCREEN_WIDTH / 2 + 50) && y > (SCREEN_HEIGHT / 2 + 30) && y < (SCREEN_HEIGHT / 2 + 70)) {
-                gameOver = false;
-                player.x = SCREEN_WIDTH / 2;
-                player.y = SCREEN_HEIGHT / 2;
-                startTime = SDL_GetTicks();
-                attacks.clear();
-                
-                // Restart background music
-                Mix_HaltMusic();
-                Mix_PlayMusic(gBackgroundMusic, -1);
+                restartGame(world);
+                restartMusic();
             }
         }
     }
 }
 
-void update(GameObject& player, std::vector<GameObject>& attacks, int& lastSpawnTime, bool& gameOver, float attackSpeed, const std::vector<SDL_Texture*>& attackTextures, int elapsedTime) {
-    player.x += player.velX;
-    player.y += player.velY;
+void update(World& world) {
+    GameObject& player = world.player;
+    AttackPool& attacks = world.attacks;
+    int elapsedTime = ticksToMilliseconds(world.simTicks);
+
+    player.prevX = player.x;
+    player.prevY = player.y;
+    player.x += player.velX * SIM_TICK_SECONDS;
+    player.y += player.velY * SIM_TICK_SECONDS;
 
     //Player leaving window
     if (player.x < 0) player.x = 0;
@@ -331,154 +1777,1942 @@ void update(GameObject& player, std::vector<GameObject>& attacks, int& lastSpawn
     if (player.x > SCREEN_WIDTH - PLAYER_SIZE) player.x = SCREEN_WIDTH - PLAYER_SIZE;
     if (player.y > SCREEN_HEIGHT - PLAYER_SIZE) player.y = SCREEN_HEIGHT - PLAYER_SIZE;
 
-    //choose side
-    int currentTime = SDL_GetTicks();
-    if (currentTime - lastSpawnTime > ATTACK_SPAWN_INTERVAL) {
-        GameObject attack;
-        int side = rand() % 4;
-        switch (side) {
-            case 0: // Top
-                attack = { rand() % SCREEN_WIDTH, -ATTACK_SIZE, ATTACK_SIZE, 0, 0, NULL, 0, SDL_FLIP_NONE };
-                break;
-            case 1: // Bottom
-                attack = { rand() % SCREEN_WIDTH, SCREEN_HEIGHT, ATTACK_SIZE, 0, 0, NULL, 0, SDL_FLIP_NONE };
-                break;
-            case 2: // Left
-                attack = { -ATTACK_SIZE, rand() % SCREEN_HEIGHT, ATTACK_SIZE, 0, 0, NULL, 0, SDL_FLIP_NONE };
-                break;
-            case 3: // Right
-                attack = { SCREEN_WIDTH, rand() % SCREEN_HEIGHT, ATTACK_SIZE, 0, 0, NULL, 0, SDL_FLIP_NONE };
-                break;
+    if (elapsedTime - world.lastSpawnTime > world.tuning.spawnInterval) {
+        // Assign the attack sprite based on elapsed time
+        int sprite = (elapsedTime / world.tuning.changeInterval) % ATTACK_SPRITES;
+        spawnAttackFromEdge(world, sprite);
+        world.lastSpawnTime = elapsedTime;
+    }
+
+    // No attack moved further than the fastest one spawned, even when the speed ramp slows new ones down
+    Fixed maxStep = world.maxAttackStep;
+    bool parallel = gAttackJobs != NULL && attacks.count >= PARALLEL_ATTACK_COUNT;
+    int hit;
+    if (parallel) {
+        hit = updateAttacksParallel(*gAttackJobs, player, attacks, maxStep);
+    } else {
+        if (attacks.gridStale) {
+            rebuildGrid(attacks);
         }
+        integrateAttacks(attacks);
+        updateGrid(attacks);
+        hit = findPlayerCollision(player, attacks, maxStep);
+    }
 
-        //Pathfinding between Player and Attack
-        double angle = atan2(player.y - attack.y, player.x - attack.x);
-        attack.velX = static_cast<int>(attackSpeed * cos(angle));
-        attack.velY = static_cast<int>(attackSpeed * sin(angle));
+    if (hit >= 0) {
+        if (world.invulnerable) {
+            world.ignoredCollisions++;
+        } else {
+            world.gameOver = true;
+            world.survivalTime = elapsedTime;
+            return;
+        }
+    }
 
-        // Assign the attack texture based on elapsed time
-        attack.texture = attackTextures[(elapsedTime / ATTACK_CHANGE_INTERVAL) % attackTextures.size()];
+    if (parallel) {
+        compactAttacks(attacks, gAttackUpdate);
+        return;
+    }
+    for (int i = 0; i < attacks.count;) {
+        //Check if out of bounds, the last attack is swapped into this slot and processed next
+        if (attackOffScreen(attacks, i)) {
+            removeAttack(attacks, i);
+        } else {
+            ++i;
+        }
+    }
+}
 
-        attacks.push_back(attack);
-        lastSpawnTime = currentTime;
+// Spawns an attack on a random screen edge aimed at the player
+void spawnAttackFromEdge(World& world, int sprite) {
+    const GameObject& player = world.player;
+    //choose side
+    int spawnX = 0, spawnY = 0;
+    int side = randomInt(world.random, 4);
+    switch (side) {
+        case 0: // Top
+            spawnX = randomInt(world.random, SCREEN_WIDTH);
+            spawnY = -ATTACK_SIZE;
+            break;
+        case 1: // Bottom
+            spawnX = randomInt(world.random, SCREEN_WIDTH);
+            spawnY = SCREEN_HEIGHT;
+            break;
+        case 2: // Left
+            spawnX = -ATTACK_SIZE;
+            spawnY = randomInt(world.random, SCREEN_HEIGHT);
+            break;
+        case 3: // Right
+            spawnX = SCREEN_WIDTH;
+            spawnY = randomInt(world.random, SCREEN_HEIGHT);
+            break;
     }
 
-    for (auto i = attacks.begin(); i != attacks.end();) {
-        i->x += i->velX;
-        i->y += i->velY;
+    //Pathfinding between Player and Attack
+    int angle = angleOf(toFixed(player.x) - spawnX * FIXED_ONE, toFixed(player.y) - spawnY * FIXED_ONE);
+    Sint64 speed = attackStep(world.attackSpeed);
+    world.maxAttackStep = SDL_max(world.maxAttackStep, (Fixed)speed);
+    Fixed velX = (Fixed)((speed * gDirectionX[angle]) >> FIXED_SHIFT);
+    Fixed velY = (Fixed)((speed * gDirectionY[angle]) >> FIXED_SHIFT);
 
-        if (checkCollision(player, *i)) {
-            gameOver = true;
-            survivalTime = elapsedTime;
-            break;
+    spawnAttack(world.attacks, spawnX * FIXED_ONE, spawnY * FIXED_ONE, velX, velY, sprite);
+}
+
+// First position with minX < x < maxX and minY < y < maxY. With the player's bounds this is the
+// same test as checkCollision() reduced to four integer compares per lane.
+#ifdef HAVE_SSE2
+static int findFirstCollisionSSE2(Fixed minX, Fixed maxX, Fixed minY, Fixed maxY, const Fixed* xs, const Fixed* ys, int count) {
+    const __m128i vMinX = _mm_set1_epi32(minX), vMaxX = _mm_set1_epi32(maxX);
+    const __m128i vMinY = _mm_set1_epi32(minY), vMaxY = _mm_set1_epi32(maxY);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(xs + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(ys + i));
+        __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(x, vMinX), _mm_cmplt_epi32(x, vMaxX)),
+                                    _mm_and_si128(_mm_cmpgt_epi32(y, vMinY), _mm_cmplt_epi32(y, vMaxY)));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
+        if (mask != 0) {
+            for (int lane = 0; ; ++lane) {
+                if (mask & (1 << lane)) return i + lane;
+            }
         }
+    }
+    return i;
+}
 
-        //Check if out of bounds
-        if (i->x < -ATTACK_SIZE || i->y < -ATTACK_SIZE || i->x > SCREEN_WIDTH || i->y > SCREEN_HEIGHT) {
-            i = attacks.erase(i);
-        } else {
-            ++i;
+TARGET_AVX2 static int findFirstCollisionAVX2(Fixed minX, Fixed maxX, Fixed minY, Fixed maxY, const Fixed* xs, const Fixed* ys, int count) {
+    const __m256i vMinX = _mm256_set1_epi32(minX), vMaxX = _mm256_set1_epi32(maxX);
+    const __m256i vMinY = _mm256_set1_epi32(minY), vMaxY = _mm256_set1_epi32(maxY);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(xs + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(ys + i));
+        __m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(x, vMinX), _mm256_cmpgt_epi32(vMaxX, x)),
+                                       _mm256_and_si256(_mm256_cmpgt_epi32(y, vMinY), _mm256_cmpgt_epi32(vMaxY, y)));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        if (mask != 0) {
+            for (int lane = 0; ; ++lane) {
+                if (mask & (1 << lane)) return i + lane;
+            }
         }
     }
+    return i;
 }
 
-void render(const GameObject& player, SDL_Texture* walkTexture, int walkFrames, const std::vector<GameObject>& attacks, int elapsedTime, bool gameOver, int survivalTime) {
-    // Render background
-    SDL_RenderCopy(gRenderer, gBackgroundTexture, NULL, NULL);
+// Four lanes of x += vel after saving the previous position, SSE2 has no wider integer add
+static void integrateAxisSSE2(Fixed* positions, Fixed* previous, const Fixed* velocities, int count) {
+    for (int i = 0; i + 4 <= count; i += 4) {
+        __m128i position = _mm_loadu_si128((const __m128i*)(positions + i));
+        _mm_storeu_si128((__m128i*)(previous + i), position);
+        _mm_storeu_si128((__m128i*)(positions + i), _mm_add_epi32(position, _mm_loadu_si128((const __m128i*)(velocities + i))));
+    }
+}
+#endif
 
-    SDL_Rect srcRect, destRect;
-    destRect = { player.x, player.y, PLAYER_SIZE, PLAYER_SIZE };
+int findFirstInBounds(Fixed minX, Fixed maxX, Fixed minY, Fixed maxY, const Fixed* xs, const Fixed* ys, int count) {
+    int i = 0;
+#ifdef HAVE_SSE2
+    // The vector kernels stop at the first hit or at the last full block, the tail is scalar
+    if (gHasAVX2) {
+        i = findFirstCollisionAVX2(minX, maxX, minY, maxY, xs, ys, count);
+    }
+    i += findFirstCollisionSSE2(minX, maxX, minY, maxY, xs + i, ys + i, count - i);
+#endif
+    for (; i < count; ++i) {
+        if (xs[i] > minX && xs[i] < maxX && ys[i] > minY && ys[i] < maxY) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    if (player.velX != 0 || player.velY != 0) {
-        srcRect = { player.frame * PLAYER_SIZE, 0, PLAYER_SIZE, PLAYER_SIZE };
-        SDL_RenderCopyEx(gRenderer, walkTexture, &srcRect, &destRect, 0, NULL, player.flip);
+// Moves every attack one tick. Only integer adds, so the result is the same on every machine
+// and with or without the vector path.
+void integrateAttacks(AttackPool& attacks) {
+    integrateAttackRange(attacks, 0, attacks.count);
+}
+
+void integrateAttackRange(AttackPool& attacks, int start, int end) {
+    int i = start;
+#ifdef HAVE_SSE2
+    integrateAxisSSE2(attacks.x + start, attacks.prevX + start, attacks.velX + start, end - start);
+    integrateAxisSSE2(attacks.y + start, attacks.prevY + start, attacks.velY + start, end - start);
+    i = start + ((end - start) & ~3);
+#endif
+    for (; i < end; ++i) {
+        attacks.prevX[i] = attacks.x[i];
+        attacks.prevY[i] = attacks.y[i];
+        attacks.x[i] += attacks.velX[i];
+        attacks.y[i] += attacks.velY[i];
+    }
+}
+
+bool attackOffScreen(const AttackPool& attacks, int i) {
+    return attacks.x[i] < -ATTACK_SIZE * FIXED_ONE || attacks.y[i] < -ATTACK_SIZE * FIXED_ONE || attacks.x[i] > SCREEN_WIDTH * FIXED_ONE || attacks.y[i] > SCREEN_HEIGHT * FIXED_ONE;
+}
+
+static bool attacksOverlap(const AttackPool& attacks, int a, int b) {
+    return checkCollision(attacks.x[a], attacks.y[a], ATTACK_SIZE, attacks.x[b], attacks.y[b], ATTACK_SIZE);
+}
+
+// Cell under a whole-pixel position, anything left of or above the grid truncates into cell 0
+static int gridCellOf(int x, int y) {
+    int column = (x - GRID_ORIGIN) / GRID_CELL_SIZE;
+    int row = (y - GRID_ORIGIN) / GRID_CELL_SIZE;
+    column = SDL_clamp(column, 0, GRID_COLUMNS - 1);
+    row = SDL_clamp(row, 0, GRID_ROWS - 1);
+    return row * GRID_COLUMNS + column;
+}
+
+static void gridLink(SpatialGrid& grid, int index, int cell) {
+    grid.cell[index] = (Sint16)cell;
+    grid.prev[index] = -1;
+    grid.next[index] = grid.head[cell];
+    if (grid.head[cell] >= 0) {
+        grid.prev[grid.head[cell]] = index;
+    }
+    grid.head[cell] = index;
+}
+
+static void gridUnlink(SpatialGrid& grid, int index) {
+    if (grid.prev[index] >= 0) {
+        grid.next[grid.prev[index]] = grid.next[index];
     } else {
-        SDL_RenderCopyEx(gRenderer, player.texture, NULL, &destRect, 0, NULL, player.flip);
+        grid.head[grid.cell[index]] = grid.next[index];
     }
+    if (grid.next[index] >= 0) {
+        grid.prev[grid.next[index]] = grid.prev[index];
+    }
+}
 
-    for (const auto& attack : attacks) {
-        SDL_Rect attackRect = { attack.x, attack.y, ATTACK_SIZE, ATTACK_SIZE };
-        SDL_RenderCopy(gRenderer, attack.texture, NULL, &attackRect);
+void updateGrid(AttackPool& attacks) {
+    for (int i = 0; i < attacks.count; ++i) {
+        int cell = gridCellOf(attacks.x[i] >> FIXED_SHIFT, attacks.y[i] >> FIXED_SHIFT);
+        if (cell != attacks.grid.cell[i]) {
+            gridUnlink(attacks.grid, i);
+            gridLink(attacks.grid, i, cell);
+        }
     }
+}
 
-    // Render timer
-    int seconds = elapsedTime / 1000;
-    int minutes = seconds / 60;
-    seconds = seconds % 60;
-    std::string timerText = std::to_string(minutes) + ":" + (seconds < 10 ? "0" : "") + std::to_string(seconds);
-    SDL_Texture* timerTexture = renderText(timerText, TEXT_COLOR);
-    int textWidth, textHeight;
-    SDL_QueryTexture(timerTexture, NULL, NULL, &textWidth, &textHeight);
-    SDL_Rect textRect = { 10, 10, textWidth, textHeight };
-    SDL_RenderCopy(gRenderer, timerTexture, NULL, &textRect);
-    SDL_DestroyTexture(timerTexture);
+// Swept AABB test over the last tick. Both boxes move in a straight line from their previous to
+// their current position, so relative to the player the attack's offset is r(t) = r0 + t * d and
+// it overlaps wherever -ATTACK_SIZE < r(t) < player.size holds on both axes. A hit is any
+// t in [0, 1] inside both of those open intervals, which at t = 1 is the old end-of-tick test.
+bool sweptCollision(const GameObject& player, const AttackPool& attacks, int index) {
+    double startX = fromFixed(attacks.prevX[index]) - (double)player.prevX, startY = fromFixed(attacks.prevY[index]) - (double)player.prevY;
+    double endX = fromFixed(attacks.x[index]) - (double)player.x, endY = fromFixed(attacks.y[index]) - (double)player.y;
+    double starts[2] = { startX, startY }, deltas[2] = { endX - startX, endY - startY };
+    double enter = -1.0, exit = 2.0;
+    for (int axis = 0; axis < 2; ++axis) {
+        double low = -ATTACK_SIZE - starts[axis], high = player.size - starts[axis]; // bounds on t * delta
+        if (deltas[axis] == 0) {
+            if (low >= 0 || high <= 0) {
+                return false; // never overlapping on this axis
+            }
+            continue;
+        }
+        double first = low / deltas[axis], second = high / deltas[axis];
+        enter = SDL_max(enter, SDL_min(first, second));
+        exit = SDL_min(exit, SDL_max(first, second));
+    }
+    return enter < exit && enter < 1.0 && exit > 0.0;
+}
 
-    if (gameOver) {
-        // Render a black screen
-        SDL_Rect fillRect = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
-        SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
-        SDL_RenderFillRect(gRenderer, &fillRect);
-
-        // Render Game Over text
-        std::string gameOverText = "Game Over!";
-        SDL_Texture* gameOverTexture = renderText(gameOverText, TEXT_COLOR);
-        SDL_QueryTexture(gameOverTexture, NULL, NULL, &textWidth, &textHeight);
-        textRect = { (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - textHeight) / 2, textWidth, textHeight };
-        SDL_RenderCopy(gRenderer, gameOverTexture, NULL, &textRect);
-        SDL_DestroyTexture(gameOverTexture);
-
-        // Render Survival Time
-        int survivalSeconds = survivalTime / 1000;
-        int survivalMinutes = survivalSeconds / 60;
-        survivalSeconds = survivalSeconds % 60;
-        std::string survivalText = "Survived: " + std::to_string(survivalMinutes) + ":" + (survivalSeconds < 10 ? "0" : "") + std::to_string(survivalSeconds);
-        SDL_Texture* survivalTexture = renderText(survivalText, TEXT_COLOR);
-        SDL_QueryTexture(survivalTexture, NULL, NULL, &textWidth, &textHeight);
-        textRect = { (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - textHeight) / 2 + 30, textWidth, textHeight };
-        SDL_RenderCopy(gRenderer, survivalTexture, NULL, &textRect);
-        SDL_DestroyTexture(survivalTexture);
-
-        // Render Restart button wih grey background
-        std::string restartText = "Restart";
-        SDL_Texture* restartTexture = renderText(restartText, TEXT_COLOR);
-        SDL_QueryTexture(restartTexture, NULL, NULL, &textWidth, &textHeight);
-        SDL_Rect restartRect = { (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - textHeight) / 2 + 60, textWidth, textHeight };
-        SDL_Rect restartBgRect = { restartRect.x - 10, restartRect.y + 7, restartRect.w + 20, restartRect.h - 8 };
-        SDL_SetRenderDrawColor(gRenderer, RESTART_BUTTON_COLOR.r, RESTART_BUTTON_COLOR.g, RESTART_BUTTON_COLOR.b, RESTART_BUTTON_COLOR.a);
-        SDL_RenderFillRect(gRenderer, &restartBgRect);
-        SDL_RenderCopy(gRenderer, restartTexture, NULL, &restartRect);
-        SDL_DestroyTexture(restartTexture);
+// Runs the exact test on every batched candidate whose end position passes the bounds filter
+static int findSweptHit(const GameObject& player, const AttackPool& attacks, Fixed minX, Fixed maxX, Fixed minY, Fixed maxY,
+                        const Fixed* xs, const Fixed* ys, const int* indices, int count) {
+    for (int start = 0, hit; (hit = findFirstInBounds(minX, maxX, minY, maxY, xs + start, ys + start, count - start)) >= 0; start += hit + 1) {
+        if (sweptCollision(player, attacks, indices[start + hit])) {
+            return indices[start + hit];
+        }
     }
+    return -1;
+}
 
-    SDL_RenderPresent(gRenderer);
+// Box that contains the end position of every attack that could have touched the player's swept
+// box this tick, as minX, maxX, minY, maxY
+static void playerQueryBounds(const GameObject& player, Fixed maxStep, Fixed bounds[4]) {
+    Fixed left = toFixed(SDL_min(player.prevX, player.x)), right = toFixed(SDL_max(player.prevX, player.x));
+    Fixed top = toFixed(SDL_min(player.prevY, player.y)), bottom = toFixed(SDL_max(player.prevY, player.y));
+    bounds[0] = left - ATTACK_SIZE * FIXED_ONE - maxStep - FIXED_ONE;
+    bounds[1] = right + player.size * FIXED_ONE + maxStep + FIXED_ONE;
+    bounds[2] = top - ATTACK_SIZE * FIXED_ONE - maxStep - FIXED_ONE;
+    bounds[3] = bottom + player.size * FIXED_ONE + maxStep + FIXED_ONE;
+}
+
+// Candidates come from the grid cells under the player's swept box grown by the furthest any attack
+// can move in a tick. Their end positions are batched through the vectorized findFirstInBounds()
+// as a conservative filter and only the survivors get the exact sweptCollision() test.
+int findPlayerCollision(const GameObject& player, const AttackPool& attacks, Fixed maxStep) {
+    Fixed bounds[4];
+    playerQueryBounds(player, maxStep, bounds);
+    Fixed minX = bounds[0], maxX = bounds[1], minY = bounds[2], maxY = bounds[3];
+    int first = gridCellOf(minX >> FIXED_SHIFT, minY >> FIXED_SHIFT);
+    int last = gridCellOf(maxX >> FIXED_SHIFT, maxY >> FIXED_SHIFT);
+    Fixed xs[COLLISION_BATCH], ys[COLLISION_BATCH];
+    int indices[COLLISION_BATCH];
+    int count = 0;
+
+    for (int row = first / GRID_COLUMNS; row <= last / GRID_COLUMNS; ++row) {
+        for (int column = first % GRID_COLUMNS; column <= last % GRID_COLUMNS; ++column) {
+            for (int i = attacks.grid.head[row * GRID_COLUMNS + column]; i >= 0; i = attacks.grid.next[i]) {
+                xs[count] = attacks.x[i];
+                ys[count] = attacks.y[i];
+                indices[count++] = i;
+                if (count == COLLISION_BATCH) {
+                    int hit = findSweptHit(player, attacks, minX, maxX, minY, maxY, xs, ys, indices, count);
+                    if (hit >= 0) return hit;
+                    count = 0;
+                }
+            }
+        }
+    }
+
+    return findSweptHit(player, attacks, minX, maxX, minY, maxY, xs, ys, indices, count);
 }
 
-bool checkCollision(const GameObject& a, const GameObject& b) {
-    int leftA = a.x;
-    int rightA = a.x + a.size;
-    int topA = a.y;
-    int bottomA = a.y + a.size;
+// Calls back once for every pair of overlapping attacks. Each cell is paired with itself and with
+// the four neighbours ahead of it, so every adjacent pair of cells is visited exactly once.
+void forEachAttackPair(AttackPool& attacks, void (*callback)(int a, int b, void* userdata), void* userdata) {
+    static const int neighbours[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+    if (attacks.gridStale) {
+        rebuildGrid(attacks); // left behind by a parallel update
+    }
+    const SpatialGrid& grid = attacks.grid;
 
-    int leftB = b.x;
-    int rightB = b.x + b.size;
-    int topB = b.y;
-    int bottomB = b.y + b.size;
+    for (int row = 0; row < GRID_ROWS; ++row) {
+        for (int column = 0; column < GRID_COLUMNS; ++column) {
+            for (int a = grid.head[row * GRID_COLUMNS + column]; a >= 0; a = grid.next[a]) {
+                for (int b = grid.next[a]; b >= 0; b = grid.next[b]) {
+                    if (attacksOverlap(attacks, a, b)) {
+                        callback(a, b, userdata);
+                    }
+                }
 
-    if (bottomA <= topB) {
-        return false;
+                for (int n = 0; n < 4; ++n) {
+                    int neighbourColumn = column + neighbours[n][0];
+                    int neighbourRow = row + neighbours[n][1];
+                    if (neighbourColumn < 0 || neighbourColumn >= GRID_COLUMNS || neighbourRow >= GRID_ROWS) {
+                        continue;
+                    }
+                    for (int b = grid.head[neighbourRow * GRID_COLUMNS + neighbourColumn]; b >= 0; b = grid.next[b]) {
+                        if (attacksOverlap(attacks, a, b)) {
+                            callback(a, b, userdata);
+                        }
+                    }
+                }
+            }
+        }
     }
+}
 
-    if (topA >= bottomB) {
+bool spawnAttack(AttackPool& attacks, Fixed x, Fixed y, Fixed velX, Fixed velY, int sprite) {
+    if (attacks.count == MAX_ATTACKS) {
         return false;
     }
 
-    if (rightA <= leftB) {
-        return false;
+    int i = attacks.count++;
+    attacks.x[i] = attacks.prevX[i] = x;
+    attacks.y[i] = attacks.prevY[i] = y;
+    attacks.velX[i] = velX;
+    attacks.velY[i] = velY;
+    attacks.sprite[i] = (Uint8)sprite;
+    if (!attacks.gridStale) {
+        gridLink(attacks.grid, i, gridCellOf(x >> FIXED_SHIFT, y >> FIXED_SHIFT));
     }
+    return true;
+}
 
-    if (leftA >= rightB) {
-        return false;
+static void moveAttack(AttackPool& attacks, int from, int to) {
+    attacks.x[to] = attacks.x[from];
+    attacks.y[to] = attacks.y[from];
+    attacks.prevX[to] = attacks.prevX[from];
+    attacks.prevY[to] = attacks.prevY[from];
+    attacks.velX[to] = attacks.velX[from];
+    attacks.velY[to] = attacks.velY[from];
+    attacks.sprite[to] = attacks.sprite[from];
+}
+
+void removeAttack(AttackPool& attacks, int index) {
+    int last = --attacks.count;
+    if (!attacks.gridStale) {
+        gridUnlink(attacks.grid, index);
+        if (index != last) {
+            gridUnlink(attacks.grid, last);
+            gridLink(attacks.grid, index, attacks.grid.cell[last]);
+        }
+    }
+    if (index != last) {
+        moveAttack(attacks, last, index);
+    }
+}
+
+void clearAttacks(AttackPool& attacks) {
+    attacks.count = 0;
+    attacks.gridStale = false;
+    for (int cell = 0; cell < GRID_CELLS; ++cell) {
+        attacks.grid.head[cell] = -1;
     }
+}
 
+void rebuildGrid(AttackPool& attacks) {
+    int count = attacks.count;
+    clearAttacks(attacks);
+    attacks.count = count;
+    for (int i = 0; i < count; ++i) {
+        gridLink(attacks.grid, i, gridCellOf(attacks.x[i] >> FIXED_SHIFT, attacks.y[i] >> FIXED_SHIFT));
+    }
+}
+
+// Integrates, tests against the player and finds the off-screen attacks of one chunk. Chunks
+// touch disjoint slices of the pool, the grid is left stale.
+void runAttackChunkJob(void* data, int index, int) {
+    AttackUpdateJobs& jobs = *(AttackUpdateJobs*)data;
+    AttackPool& attacks = *jobs.attacks;
+    AttackChunk& chunk = jobs.chunks[index];
+    int start = index * ATTACK_CHUNK_SIZE, end = SDL_min(start + ATTACK_CHUNK_SIZE, attacks.count);
+    integrateAttackRange(attacks, start, end);
+
+    const Fixed* bounds = jobs.bounds;
+    chunk.hit = -1;
+    for (int first = start, hit; (hit = findFirstInBounds(bounds[0], bounds[1], bounds[2], bounds[3], attacks.x + first, attacks.y + first, end - first)) >= 0; first += hit + 1) {
+        if (sweptCollision(*jobs.player, attacks, first + hit)) {
+            chunk.hit = first + hit;
+            break;
+        }
+    }
+
+    int* removed = jobs.removed + start;
+    chunk.removedCount = 0;
+    for (int i = start; i < end; ++i) {
+        if (attackOffScreen(attacks, i)) {
+            removed[chunk.removedCount++] = i;
+        }
+    }
+}
+
+// Same result as integrateAttacks(), findPlayerCollision() and the off-screen scan, split into
+// ATTACK_CHUNK_SIZE jobs. Returns the lowest colliding index, whatever worker found it.
+int updateAttacksParallel(JobSystem& system, const GameObject& player, AttackPool& attacks, Fixed maxStep) {
+    AttackUpdateJobs& jobs = gAttackUpdate;
+    jobs.attacks = &attacks;
+    jobs.player = &player;
+    playerQueryBounds(player, maxStep, jobs.bounds);
+    attacks.gridStale = true;
+
+    int chunkCount = (attacks.count + ATTACK_CHUNK_SIZE - 1) / ATTACK_CHUNK_SIZE;
+    runJobs(system, runAttackChunkJob, &jobs, chunkCount, 1);
+
+    for (int chunk = 0; chunk < chunkCount; ++chunk) {
+        if (jobs.chunks[chunk].hit >= 0) {
+            return jobs.chunks[chunk].hit;
+        }
+    }
+    return -1;
+}
+
+// Removes the attacks the chunks flagged, in the same order the serial swap-and-pop loop would:
+// each removed slot, lowest first, takes the highest surviving attack, and removed attacks that
+// end up on top are popped. Attack order feeds the state hash, so both paths must agree.
+void compactAttacks(AttackPool& attacks, AttackUpdateJobs& jobs) {
+    int chunkCount = (attacks.count + ATTACK_CHUNK_SIZE - 1) / ATTACK_CHUNK_SIZE;
+    int removedCount = 0;
+    for (int chunk = 0; chunk < chunkCount; ++chunk) {
+        SDL_memmove(jobs.removed + removedCount, jobs.removed + chunk * ATTACK_CHUNK_SIZE, jobs.chunks[chunk].removedCount * sizeof(int));
+        removedCount += jobs.chunks[chunk].removedCount;
+    }
+
+    int last = attacks.count - 1;
+    int top = removedCount - 1; // highest removed attack not yet popped
+    for (int next = 0; next < removedCount; ++next) {
+        while (top >= next && jobs.removed[top] == last) {
+            last--;
+            top--;
+        }
+        if (top < next) {
+            break; // this slot and everything above it were popped
+        }
+        moveAttack(attacks, last, jobs.removed[next]);
+        last--;
+    }
+    attacks.count = last + 1;
+}
+
+void saveSnapshot(const World& world, Snapshot& snapshot) {
+    const AttackPool& attacks = world.attacks;
+    int count = attacks.count;
+    SDL_memcpy(snapshot.world, &world, sizeof(snapshot.world));
+    snapshot.attackCount = count;
+
+    Uint8* packed = snapshot.attacks;
+    const Fixed* fields[] = { attacks.x, attacks.y, attacks.prevX, attacks.prevY, attacks.velX, attacks.velY };
+    for (int field = 0; field < 6; ++field) {
+        SDL_memcpy(packed, fields[field], count * sizeof(Fixed));
+        packed += count * sizeof(Fixed);
+    }
+    SDL_memcpy(packed, attacks.sprite, count);
+    packed += count;
+    snapshot.size = (Uint32)(packed - (Uint8*)&snapshot);
+}
+
+// The grid is not part of a snapshot, it is rebuilt from the positions. Cell lists may come back
+// in a different order, which no query depends on.
+void restoreSnapshot(World& world, const Snapshot& snapshot) {
+    AttackPool& attacks = world.attacks;
+    int count = snapshot.attackCount;
+    SDL_memcpy(&world, snapshot.world, sizeof(snapshot.world));
+    attacks.count = count;
+
+    const Uint8* packed = snapshot.attacks;
+    Fixed* fields[] = { attacks.x, attacks.y, attacks.prevX, attacks.prevY, attacks.velX, attacks.velY };
+    for (int field = 0; field < 6; ++field) {
+        SDL_memcpy(fields[field], packed, count * sizeof(Fixed));
+        packed += count * sizeof(Fixed);
+    }
+    SDL_memcpy(attacks.sprite, packed, count);
+    rebuildGrid(attacks);
+}
+
+void copySnapshot(Snapshot& destination, const Snapshot& source) {
+    SDL_memcpy(&destination, &source, source.size);
+}
+
+void stepSimulation(World& world) {
+    const Uint32 attackChangeTicks = SDL_max(world.tuning.changeInterval * SIM_TICK_RATE / 1000, 1);
+
+    update(world);
+    world.simTicks++;
+    if (world.simTicks % attackChangeTicks == 0) {
+        world.attackSpeed *= world.tuning.speedRamp; // 20% faster every ATTACK_CHANGE_INTERVAL by default
+    }
+}
+
+void runHeadless(World& world, Replay& replay) {
+    bool quit = false;
+    bool playing = (replay.file != NULL && !replay.recording);
+    Uint32 ticksRun = 0;
+    Uint64 startCounter = SDL_GetPerformanceCounter();
+
+    // No render() and no pacing, every iteration is one simulation tick
+    while (!quit && (gMaxTicks == 0 || ticksRun < gMaxTicks)) {
+        Uint64 phaseStart = beginFrameTiming();
+        handleEvents(quit, world);
+        phaseStart = endPhase(PHASE_EVENTS, phaseStart);
+
+        Uint8 input;
+        if (playing) {
+            if (!nextReplayInput(replay, input)) {
+                break;
+            }
+            if (input & INPUT_RESTART) {
+                restartGame(world);
+            }
+            applyInput(input, world.player);
+        } else {
+            if (gBotPlays && !world.gameOver) {
+                applyInput(botInput(world, gBotPolicy, gBotRng, encodeInput(world.player, false), &gLookahead), world.player);
+            }
+            input = encodeInput(world.player, false);
+        }
+
+        if (world.gameOver) {
+            if (playing) {
+                printf("Replay continues after game over, it does not match this build!\n");
+            }
+            break;
+        }
+
+        recordReplayInput(replay, input);
+        stepSimulation(world);
+        ticksRun++;
+        endPhase(PHASE_UPDATE, phaseStart);
+        endFrameTiming();
+    }
+
+    double wallSeconds = (double)(SDL_GetPerformanceCounter() - startCounter) / SDL_GetPerformanceFrequency();
+    int survived = world.gameOver ? world.survivalTime : ticksToMilliseconds(world.simTicks);
+    printf("Simulated %u ticks in %.3f s (%.0f ticks/s)\n", ticksRun, wallSeconds, wallSeconds > 0 ? ticksRun / wallSeconds : 0.0);
+    printf("Survived: %d.%03d s%s\n", survived / 1000, survived % 1000, world.gameOver ? "" : " (run ended before game over)");
+    printf("Seed %llu, state hash %08x\n", (unsigned long long)gSeed, hashState(world));
+}
+
+static void countAttackPair(int, int, void* userdata) {
+    ++*(int*)userdata;
+}
+
+static void countJobIndex(void* data, int index, int) {
+    SDL_AtomicIncRef(&((SDL_atomic_t*)data)[index]);
+}
+
+// Submits batches back to back, the way update() and the lookahead bot do every tick, on more
+// workers than there are cores so helpers are still finishing one batch when the next starts.
+// Returns false if any index of any batch did not run exactly once.
+static bool checkJobBatches() {
+    JobSystem& system = *new JobSystem();
+    if (!startJobSystem(system, SDL_min(SDL_GetCPUCount() * 2 + 2, MAX_WORKERS))) {
+        delete &system;
+        return false;
+    }
+    static SDL_atomic_t runs[BENCH_JOB_INDICES];
+    bool exact = true;
+    for (int batch = 0; batch < BENCH_JOB_BATCHES && exact; ++batch) {
+        int count = 1 + batch % BENCH_JOB_INDICES;
+        for (int index = 0; index < count; ++index) {
+            SDL_AtomicSet(&runs[index], 0);
+        }
+        runJobs(system, countJobIndex, runs, count, 1);
+        for (int index = 0; index < count; ++index) {
+            exact = exact && SDL_AtomicGet(&runs[index]) == 1;
+        }
+    }
+    stopJobSystem(system);
+    delete &system;
+    return exact;
+}
+
+// Plain headless runs never call render(), so nothing that only speeds up drawing is worth building
+bool drawsFrames() {
+    return !gHeadless || gBenchmark;
+}
+
+// Keeps stdout for the benchmark's JSON object alone, so it can be piped straight into a parser.
+// Everything else printed while the benchmark runs, warnings included, goes to stderr instead.
+void separateBenchOutput() {
+    gBenchOutput = stdout;
+    fflush(stdout);
+#if defined(HAVE_MMAP)
+    int json = dup(STDOUT_FILENO);
+    FILE* output = json >= 0 ? fdopen(json, "w") : NULL;
+    if (output != NULL && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0) {
+        gBenchOutput = output;
+    }
+#elif defined(_WIN32)
+    int json = _dup(_fileno(stdout));
+    FILE* output = json >= 0 ? _fdopen(json, "w") : NULL;
+    if (output != NULL && _dup2(_fileno(stderr), _fileno(stdout)) >= 0) {
+        gBenchOutput = output;
+    }
+#endif
+}
+
+// Scripted stress scenario: fixed seed, an invulnerable idle player and BENCH_SPAWNS_PER_TICK
+// extra attacks every tick until BENCH_ATTACKS are alive. Simulation and rendering are timed
+// separately and reported as one JSON object on stdout. Returns false when a frame allocated after
+// warmup or the pair query, job batch or snapshot replay checks failed.
+bool runBenchmark(World& world) {
+    Uint32 ticks = gMaxTicks > 0 ? gMaxTicks : BENCH_TICKS;
+    double counterToSeconds = 1.0 / SDL_GetPerformanceFrequency();
+    double updateSeconds = 0.0, renderSeconds = 0.0;
+    Uint32 frames = 0;
+    int peakAttacks = 0;
+    bool quit = false;
+
+    world.invulnerable = true;
+    int allocationsBefore = SDL_AtomicGet(&gAllocationCount);
+    int sdlAllocationsBefore = SDL_AtomicGet(&gSdlAllocationCount);
+    int liveAllocationsBefore = SDL_GetNumAllocations();
+
+    for (Uint32 tick = 0; tick < ticks && !quit; ++tick) {
+        Uint64 phaseStart = beginFrameTiming();
+        handleEvents(quit, world);
+        phaseStart = endPhase(PHASE_EVENTS, phaseStart);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int spawn = 0; spawn < BENCH_SPAWNS_PER_TICK && world.attacks.count < BENCH_ATTACKS; ++spawn) {
+            spawnAttackFromEdge(world, (tick + spawn) % ATTACK_SPRITES);
+        }
+        stepSimulation(world);
+        updateSeconds += (SDL_GetPerformanceCounter() - start) * counterToSeconds;
+        peakAttacks = SDL_max(peakAttacks, world.attacks.count);
+        endPhase(PHASE_UPDATE, phaseStart);
+
+        if (tick % BENCH_RENDER_INTERVAL == 0) {
+            start = SDL_GetPerformanceCounter();
+            render(world, 1.0f);
+            renderSeconds += (SDL_GetPerformanceCounter() - start) * counterToSeconds;
+            frames++;
+        }
+        endFrameTiming();
+    }
+
+    int allocations = SDL_AtomicGet(&gAllocationCount) - allocationsBefore;
+    int sdlAllocations = SDL_AtomicGet(&gSdlAllocationCount) - sdlAllocationsBefore;
+    int liveAllocations = SDL_GetNumAllocations() - liveAllocationsBefore;
+
+    // Nothing in the game queries attack pairs, so check the grid query against brute force here
+    int attackPairs = 0, brutePairs = 0;
+    forEachAttackPair(world.attacks, countAttackPair, &attackPairs);
+    for (int a = 0; a < world.attacks.count; ++a) {
+        for (int b = a + 1; b < world.attacks.count; ++b) {
+            brutePairs += attacksOverlap(world.attacks, a, b) ? 1 : 0;
+        }
+    }
+    bool jobsExact = checkJobBatches();
+
+    // Play on from the final state, then restore it and play again, both have to end the same
+    Snapshot& snapshot = *new Snapshot();
+    saveSnapshot(world, snapshot);
+    for (Uint32 tick = 0; tick < BENCH_SNAPSHOT_TICKS; ++tick) {
+        stepSimulation(world);
+    }
+    Uint32 continuedHash = hashState(world);
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int restore = 0; restore < BENCH_SNAPSHOT_RESTORES; ++restore) {
+        restoreSnapshot(world, snapshot);
+    }
+    double restoreMicroseconds = (SDL_GetPerformanceCounter() - start) * counterToSeconds * 1000000.0 / BENCH_SNAPSHOT_RESTORES;
+    for (Uint32 tick = 0; tick < BENCH_SNAPSHOT_TICKS; ++tick) {
+        stepSimulation(world);
+    }
+    bool snapshotsMatch = hashState(world) == continuedHash;
+    restoreSnapshot(world, snapshot);
+    Uint32 snapshotBytes = snapshot.size;
+    delete &snapshot;
+    fprintf(gBenchOutput, "{\"seed\": %llu, \"ticks\": %u, \"frames\": %u, \"peak_attacks\": %d, \"collisions\": %d, "
+           "\"update_seconds\": %.6f, \"render_seconds\": %.6f, \"ticks_per_sec\": %.1f, \"frames_per_sec\": %.1f, "
+           "\"allocations\": %d, \"sdl_allocations\": %d, \"sdl_live_allocations_delta\": %d, \"allocating_frames\": %u, \"allocation_free\": %s, "
+           "\"attack_pairs\": %d, \"pair_query_matches\": %s, \"job_batches_exact\": %s, \"render_scale\": %d, \"snapshot_bytes\": %u, \"snapshot_restore_us\": %.2f, \"snapshot_replay_matches\": %s, \"state_hash\": \"%08x\"}\n",
+           (unsigned long long)gSeed, world.simTicks, frames, peakAttacks, world.ignoredCollisions,
+           updateSeconds, renderSeconds, updateSeconds > 0 ? world.simTicks / updateSeconds : 0.0, renderSeconds > 0 ? frames / renderSeconds : 0.0,
+           allocations, sdlAllocations, liveAllocations, gTimings.allocatingFrames, gTimings.allocatingFrames == 0 ? "true" : "false",
+           attackPairs, attackPairs == brutePairs ? "true" : "false", jobsExact ? "true" : "false", gResolution.scale * 100 / RENDER_SCALE_STEPS, snapshotBytes, restoreMicroseconds, snapshotsMatch ? "true" : "false", hashState(world));
+    fflush(gBenchOutput);
+    return gTimings.allocatingFrames == 0 && attackPairs == brutePairs && jobsExact && snapshotsMatch;
+}
+
+// Fresh world for a new session, seeded so the same seed and inputs replay the same run
+void resetWorld(World& world, Uint64 seed) {
+    Tuning tuning = { ATTACK_SPAWN_INTERVAL, ATTACK_CHANGE_INTERVAL, INITIAL_ATTACK_SPEED, ATTACK_SPEED_RAMP };
+    resetWorld(world, seed, tuning);
+}
+
+void resetWorld(World& world, Uint64 seed, const Tuning& tuning) {
+    world.tuning = tuning;
+    world.player = { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, PLAYER_SIZE, 0, 0, 0, SPRITE_IDLE, SDL_FLIP_NONE };
+    clearAttacks(world.attacks);
+    seedRandom(world.random, seed);
+    world.simTicks = 0;
+    world.lastSpawnTime = 0;
+    world.attackSpeed = tuning.initialAttackSpeed;
+    world.maxAttackStep = 0;
+    world.gameOver = false;
+    world.survivalTime = 0;
+    world.invulnerable = false;
+    world.ignoredCollisions = 0;
+}
+
+// Restart after game over. The random stream and attack speed carry over from the last run.
+void restartGame(World& world) {
+    world.gameOver = false;
+    world.player.x = world.player.prevX = SCREEN_WIDTH / 2;
+    world.player.y = world.player.prevY = SCREEN_HEIGHT / 2;
+    world.simTicks = 0;
+    world.lastSpawnTime = 0;
+    world.maxAttackStep = 0;
+    clearAttacks(world.attacks);
+}
+
+void restartMusic() {
+    // Restart background music, unless it is still loading
+    Mix_HaltMusic();
+    if (gBackgroundMusic != NULL) {
+        Mix_PlayMusic(gBackgroundMusic, -1);
+    }
+}
+
+Uint8 encodeInput(const GameObject& player, bool restarted) {
+    Uint8 input = 0;
+    if (player.velY < 0) input |= INPUT_UP;
+    if (player.velY > 0) input |= INPUT_DOWN;
+    if (player.velX < 0) input |= INPUT_LEFT;
+    if (player.velX > 0) input |= INPUT_RIGHT;
+    if (player.flip == SDL_FLIP_HORIZONTAL) input |= INPUT_FACE_RIGHT;
+    if (restarted) input |= INPUT_RESTART;
+    return input;
+}
+
+void applyInput(Uint8 input, GameObject& player) {
+    player.velX = (input & INPUT_LEFT) ? -PLAYER_SPEED : (input & INPUT_RIGHT) ? PLAYER_SPEED : 0;
+    player.velY = (input & INPUT_UP) ? -PLAYER_SPEED : (input & INPUT_DOWN) ? PLAYER_SPEED : 0;
+    player.flip = (input & INPUT_FACE_RIGHT) ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
+}
+
+// FNV-1a over the simulated positions, equal hashes mean a replay reproduced the run
+Uint32 hashState(const World& world) {
+    const GameObject& player = world.player;
+    const AttackPool& attacks = world.attacks;
+    Uint32 hash = 2166136261u;
+    const float* values[] = { &player.x, &player.y };
+    for (int v = 0; v < 2; ++v) {
+        const Uint8* bytes = (const Uint8*)values[v];
+        for (size_t b = 0; b < sizeof(float); ++b) hash = (hash ^ bytes[b]) * 16777619u;
+    }
+    for (int i = 0; i < attacks.count; ++i) {
+        const Uint8* bytes = (const Uint8*)&attacks.x[i];
+        for (size_t b = 0; b < sizeof(attacks.x[i]); ++b) hash = (hash ^ bytes[b]) * 16777619u;
+        bytes = (const Uint8*)&attacks.y[i];
+        for (size_t b = 0; b < sizeof(attacks.y[i]); ++b) hash = (hash ^ bytes[b]) * 16777619u;
+    }
+    return hash;
+}
+
+void seedRandom(Rng& rng, Uint64 seed) {
+    rng.state = 0;
+    nextRandom(rng);
+    rng.state += seed;
+    nextRandom(rng);
+}
+
+Uint32 nextRandom(Rng& rng) {
+    Uint64 old = rng.state;
+    rng.state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    Uint32 xorshifted = (Uint32)(((old >> 18) ^ old) >> 27);
+    Uint32 rot = (Uint32)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+// Uniform in [0, bound)
+int randomInt(Rng& rng, int bound) {
+    return (int)(((Uint64)nextRandom(rng) * (Uint32)bound) >> 32);
+}
+
+bool openReplayForWriting(Replay& replay, const char* path, Uint64 seed) {
+    replay = {};
+    replay.file = SDL_RWFromFile(path, "wb");
+    if (replay.file == NULL) {
+        printf("Unable to create replay %s! SDL Error: %s\n", path, SDL_GetError());
+        return false;
+    }
+    replay.recording = true;
+    replay.seed = seed;
+
+    // The tick count is patched in when the replay is closed
+    SDL_WriteLE32(replay.file, REPLAY_MAGIC);
+    SDL_WriteLE32(replay.file, REPLAY_VERSION);
+    SDL_WriteLE64(replay.file, seed);
+    SDL_WriteLE32(replay.file, 0);
+    return true;
+}
+
+bool openReplayForReading(Replay& replay, const char* path) {
+    replay = {};
+    replay.file = SDL_RWFromFile(path, "rb");
+    if (replay.file == NULL) {
+        printf("Unable to open replay %s! SDL Error: %s\n", path, SDL_GetError());
+        return false;
+    }
+
+    if (SDL_ReadLE32(replay.file) != REPLAY_MAGIC || SDL_ReadLE32(replay.file) != REPLAY_VERSION) {
+        printf("%s is not a version %u replay!\n", path, REPLAY_VERSION);
+        SDL_RWclose(replay.file);
+        replay.file = NULL;
+        return false;
+    }
+    replay.seed = SDL_ReadLE64(replay.file);
+    replay.ticks = SDL_ReadLE32(replay.file);
+    return true;
+}
+
+static void flushReplayRun(Replay& replay) {
+    if (replay.runLength > 0) {
+        SDL_WriteU8(replay.file, replay.runInput);
+        SDL_WriteLE16(replay.file, (Uint16)replay.runLength);
+        replay.runLength = 0;
+    }
+}
+
+void recordReplayInput(Replay& replay, Uint8 input) {
+    if (!replay.recording) {
+        return;
+    }
+
+    if (input != replay.runInput || replay.runLength == REPLAY_MAX_RUN) {
+        flushReplayRun(replay);
+        replay.runInput = input;
+    }
+    replay.runLength++;
+    replay.ticks++;
+}
+
+bool nextReplayInput(Replay& replay, Uint8& input) {
+    if (replay.ticks == 0) {
+        return false;
+    }
+
+    if (replay.runLength == 0) {
+        replay.runInput = SDL_ReadU8(replay.file);
+        replay.runLength = SDL_ReadLE16(replay.file);
+        if (replay.runLength == 0) {
+            printf("Replay ended early!\n");
+            replay.ticks = 0;
+            return false;
+        }
+    }
+    input = replay.runInput;
+    replay.runLength--;
+    replay.ticks--;
+    return true;
+}
+
+void closeReplay(Replay& replay) {
+    if (replay.file == NULL) {
+        return;
+    }
+
+    if (replay.recording) {
+        flushReplayRun(replay);
+        SDL_RWseek(replay.file, 16, RW_SEEK_SET); // tick count follows magic, version and seed
+        SDL_WriteLE32(replay.file, replay.ticks);
+    }
+    SDL_RWclose(replay.file);
+    replay.file = NULL;
+}
+
+void render(const World& world, float alpha) {
+    const GameObject& player = world.player;
+    const AttackPool& attacks = world.attacks;
+    int elapsedTime = ticksToMilliseconds(world.simTicks);
+    bool gameOver = world.gameOver;
+    int survivalTime = world.survivalTime;
+    Uint64 phaseStart = SDL_GetPerformanceCounter();
+    resetFrameArena();
+
+    if (gameOver && bakeGameOverScreen(survivalTime)) {
+        // Nothing on the game-over screen changes until restart, so it is a single cached copy
+        SDL_RenderCopy(gRenderer, gGameOverTexture, NULL, NULL);
+        renderTimingHud();
+        phaseStart = endPhase(PHASE_TEXT, phaseStart);
+        presentFrame(phaseStart);
+        return;
+    }
+
+    // Destinations stay in window coordinates, sources come from the atlas shrunk to the scene scale
+    int scale = beginScene();
+    SDL_Texture* sprites = scale == RENDER_SCALE_STEPS ? gSprites.texture : gSprites.scaled[scale];
+
+    // Render background, with an explicit rect since NULL would mean the whole scaled target. The
+    // pre-stretched one is exactly the scene's size, a straight copy.
+    SDL_Rect screenRect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    if (gSprites.backgrounds[scale] != NULL) {
+        SDL_RenderCopy(gRenderer, gSprites.backgrounds[scale], NULL, &screenRect);
+    } else {
+        SDL_Rect backgroundRect = scaleRect(gSprites.rects[SPRITE_BACKGROUND], scale);
+        SDL_RenderCopy(gRenderer, sprites, &backgroundRect, &screenRect);
+    }
+    phaseStart = endPhase(PHASE_BACKGROUND, phaseStart);
+
+    SDL_Rect srcRect, destRect;
+    const SDL_Rect& walkRect = gSprites.rects[SPRITE_WALK];
+    // Draw between the last two simulation states so motion stays smooth at any frame rate
+    destRect = { interpolate(player.prevX, player.x, alpha), interpolate(player.prevY, player.y, alpha), PLAYER_SIZE, PLAYER_SIZE };
+
+    if (player.velX != 0 || player.velY != 0) {
+        srcRect = scaleRect({ walkRect.x + player.frame * PLAYER_SIZE, walkRect.y, PLAYER_SIZE, PLAYER_SIZE }, scale);
+    } else {
+        srcRect = scaleRect(gSprites.rects[player.sprite], scale);
+    }
+    SDL_RenderCopyEx(gRenderer, sprites, &srcRect, &destRect, 0, NULL, player.flip);
+
+    SDL_Rect attackSources[ATTACK_SPRITES];
+    for (int sprite = 0; sprite < ATTACK_SPRITES; ++sprite) {
+        attackSources[sprite] = scaleRect(gSprites.rects[SPRITE_ATTACK_FIRST + sprite], scale);
+    }
+    for (int i = 0; i < attacks.count; ++i) {
+        SDL_Rect attackRect = { interpolate(attacks.prevX[i], attacks.x[i], alpha), interpolate(attacks.prevY[i], attacks.y[i], alpha), ATTACK_SIZE, ATTACK_SIZE };
+        SDL_RenderCopy(gRenderer, sprites, &attackSources[attacks.sprite[i]], &attackRect);
+    }
+    endScene();
+    phaseStart = endPhase(PHASE_SPRITES, phaseStart);
+
+    // Render timer
+    int seconds = elapsedTime / 1000;
+    int minutes = seconds / 60;
+    seconds = seconds % 60;
+    renderGlyphText(gTextGlyphs, frameFormat("%d:%02d", minutes, seconds), 10, 10);
+
+    if (gameOver) {
+        // No render target support, draw the game-over screen directly every frame
+        renderGameOverScreen(survivalTime);
+    }
+    renderTimingHud();
+    phaseStart = endPhase(PHASE_TEXT, phaseStart);
+    presentFrame(phaseStart);
+}
+
+// Picks vsync when the display refreshes at the target rate, or faster so a present never
+// blocks for longer than the pacer would have waited anyway
+void initFramePacer(FramePacer& pacer, int targetRate, int refreshRate) {
+    pacer = {};
+    pacer.frameRate = targetRate > 0 ? targetRate : (refreshRate > 0 ? refreshRate : DEFAULT_FRAME_RATE);
+    pacer.vsync = refreshRate >= pacer.frameRate;
+    pacer.sleeps = refreshRate != pacer.frameRate;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    pacer.period = frequency / pacer.frameRate;
+    pacer.spin = (Uint64)(frequency * PACER_SPIN_SECONDS);
+}
+
+void waitForFrameDeadline(FramePacer& pacer) {
+    if (pacer.frameRate == 0 || !pacer.sleeps) {
+        return;
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (pacer.deadline == 0) {
+        pacer.deadline = now + pacer.period;
+        return;
+    }
+    if (now > pacer.deadline) {
+        pacer.missedDeadlines++;
+        if (now > pacer.deadline + pacer.period / 2) {
+            // So late that catching up would only burst frames, start over from now
+            pacer.deadline = now + pacer.period;
+            return;
+        }
+    }
+
+    if (pacer.deadline > now + pacer.spin) {
+        SDL_Delay((Uint32)((pacer.deadline - now - pacer.spin) * 1000 / SDL_GetPerformanceFrequency()));
+    }
+    while (SDL_GetPerformanceCounter() < pacer.deadline) {
+        SDL_CPUPauseInstruction();
+    }
+    // Advance from the deadline rather than from now, so small oversleeps don't accumulate drift
+    pacer.deadline += pacer.period;
+}
+
+// Points drawing at the scene target, scaled so the rest of render() keeps using window
+// coordinates. Returns the scale the scene is drawn at, RENDER_SCALE_STEPS when it goes
+// straight to the window.
+int beginScene() {
+    if (gResolution.target == NULL || gResolution.scale == RENDER_SCALE_STEPS || SDL_SetRenderTarget(gRenderer, gResolution.target) < 0) {
+        return RENDER_SCALE_STEPS;
+    }
+
+    // The viewport is in scaled coordinates, without it sprites outside the window would still be
+    // drawn into the unused part of the target
+    float scale = (float)gResolution.scale / RENDER_SCALE_STEPS;
+    SDL_RenderSetScale(gRenderer, scale, scale);
+    SDL_Rect viewport = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    SDL_RenderSetViewport(gRenderer, &viewport);
+    return gResolution.scale;
+}
+
+// Maps a rect at window resolution to the given scene scale
+SDL_Rect scaleRect(const SDL_Rect& rect, int scale) {
+    return { rect.x * scale / RENDER_SCALE_STEPS, rect.y * scale / RENDER_SCALE_STEPS, rect.w * scale / RENDER_SCALE_STEPS, rect.h * scale / RENDER_SCALE_STEPS };
+}
+
+// Stretches the part of the scene target that beginScene() drew into over the whole window
+void endScene() {
+    if (SDL_GetRenderTarget(gRenderer) != gResolution.target || gResolution.target == NULL) {
+        return;
+    }
+
+    // Switching back restores the window's own scale and viewport
+    SDL_SetRenderTarget(gRenderer, NULL);
+    SDL_Rect sceneRect = { 0, 0, SCREEN_WIDTH * gResolution.scale / RENDER_SCALE_STEPS, SCREEN_HEIGHT * gResolution.scale / RENDER_SCALE_STEPS };
+    SDL_RenderCopy(gRenderer, gResolution.target, &sceneRect, NULL);
+}
+
+// Moves the scene's scale a step when the work of the last RENDER_SCALE_ADJUST_FRAMES frames
+// leaves the band between the raise and lower loads. Waiting for the pacer isn't work, nor is
+// a present blocking on vsync.
+void adjustRenderScale(DynamicResolution& resolution) {
+    if (resolution.pinned || resolution.target == NULL || gTimings.historyCount == 0) {
+        return;
+    }
+
+    int last = (gTimings.historyNext + TIMING_HISTORY - 1) % TIMING_HISTORY;
+    float work = gTimings.history[PHASE_FRAME][last] - gTimings.history[PHASE_PACE][last];
+    if (gPacer.vsync) {
+        work -= gTimings.history[PHASE_PRESENT][last];
+    }
+    resolution.workMilliseconds += work;
+    if (++resolution.frames < RENDER_SCALE_ADJUST_FRAMES) {
+        return;
+    }
+
+    float budget = 1000.0f / (gPacer.frameRate != 0 ? gPacer.frameRate : DEFAULT_FRAME_RATE);
+    float load = resolution.workMilliseconds / resolution.frames / budget;
+    resolution.workMilliseconds = 0.0f;
+    resolution.frames = 0;
+    int scale = resolution.scale;
+    if (load > RENDER_SCALE_LOWER_LOAD && scale > MIN_RENDER_SCALE) {
+        scale--;
+    } else if (load < RENDER_SCALE_RAISE_LOAD && scale < RENDER_SCALE_STEPS) {
+        scale++;
+    }
+    if (scale != resolution.scale) {
+        resolution.scale = scale;
+        resolution.changes++;
+    }
+}
+
+void presentFrame(Uint64 phaseStart) {
+    waitForFrameDeadline(gPacer);
+    phaseStart = endPhase(PHASE_PACE, phaseStart);
+    SDL_RenderPresent(gRenderer);
+    Uint64 presented = endPhase(PHASE_PRESENT, phaseStart);
+
+    // With vsync alone the present blocks instead, so a miss shows up as a skipped refresh
+    if (gPacer.frameRate != 0 && !gPacer.sleeps && gPacer.lastPresent != 0 && presented - gPacer.lastPresent > gPacer.period * 3 / 2) {
+        gPacer.missedDeadlines++;
+    }
+    gPacer.lastPresent = presented;
+}
+
+bool initTimings() {
+    gTimings = {};
+    gTimings.counterToMilliseconds = 1000.0 / SDL_GetPerformanceFrequency();
+    if (gTimingsPath == NULL) {
+        return true;
+    }
+
+    gTimings.csv = fopen(gTimingsPath, "w");
+    if (gTimings.csv == NULL) {
+        printf("Unable to create timings file %s!\n", gTimingsPath);
+        return false;
+    }
+    fprintf(gTimings.csv, "frame");
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        fprintf(gTimings.csv, ",%s_ms", PHASE_NAMES[phase]);
+    }
+    fprintf(gTimings.csv, ",allocations\n");
+    return true;
+}
+
+void closeTimings() {
+    if (gTimings.csv == NULL) {
+        return;
+    }
+
+    summarizeTimings();
+    printf("Timings over the last %d frames (ms):\n", gTimings.historyCount);
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        printf("  %-10s p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f\n", PHASE_NAMES[phase],
+               gTimings.p50[phase], gTimings.p95[phase], gTimings.p99[phase], gTimings.max[phase]);
+    }
+    printf("  %u frames allocated after the first %u\n", gTimings.allocatingFrames, ALLOCATION_WARMUP_FRAMES);
+    if (gPacer.frameRate != 0) {
+        printf("  %u missed frame deadlines at %d fps (%s)\n", gPacer.missedDeadlines, gPacer.frameRate,
+               gPacer.vsync ? (gPacer.sleeps ? "vsync + sleep" : "vsync") : "sleep");
+    }
+    printf("  scene at %d%% of the window, %u scale changes\n", gResolution.scale * 100 / RENDER_SCALE_STEPS, gResolution.changes);
+    fclose(gTimings.csv);
+    gTimings.csv = NULL;
+}
+
+Uint64 beginFrameTiming() {
+    gTimings.frameStart = SDL_GetPerformanceCounter();
+    gTimings.allocationsAtStart = gThreadAllocations;
+    return gTimings.frameStart;
+}
+
+// Adds the time since start to the phase and returns now, so phases can be chained
+Uint64 endPhase(FramePhase phase, Uint64 start) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    gTimings.current[phase] += (float)((now - start) * gTimings.counterToMilliseconds);
+    if (gTracer.enabled) {
+        traceEvent(PHASE_NAMES[phase], start, now);
+    }
+    return now;
+}
+
+void endFrameTiming() {
+    Uint64 frameEnd = SDL_GetPerformanceCounter();
+    gTimings.current[PHASE_FRAME] = (float)((frameEnd - gTimings.frameStart) * gTimings.counterToMilliseconds);
+    if (gTracer.enabled) {
+        traceEvent(PHASE_NAMES[PHASE_FRAME], gTimings.frameStart, frameEnd);
+    }
+
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        gTimings.history[phase][gTimings.historyNext] = gTimings.current[phase];
+    }
+    gTimings.historyNext = (gTimings.historyNext + 1) % TIMING_HISTORY;
+    if (gTimings.historyCount < TIMING_HISTORY) {
+        gTimings.historyCount++;
+    }
+
+    // Anything the heap does in a steady-state frame is a potential p99 spike
+    gTimings.allocations = gThreadAllocations - gTimings.allocationsAtStart;
+    if (gTimings.allocations > 0 && gTimings.frames >= ALLOCATION_WARMUP_FRAMES) {
+        gTimings.allocatingFrames++;
+        if (gCheckAllocations) {
+            printf("Frame %u made %u heap allocations after warmup!\n", gTimings.frames, gTimings.allocations);
+            abort();
+        }
+    }
+
+    if (gTimings.csv != NULL) {
+        fprintf(gTimings.csv, "%u", gTimings.frames);
+        for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+            fprintf(gTimings.csv, ",%.4f", gTimings.current[phase]);
+        }
+        fprintf(gTimings.csv, ",%u\n", gTimings.allocations);
+    }
+
+    gTimings.frames++;
+    if (gTimings.hudVisible && gTimings.frames % TIMING_SUMMARY_INTERVAL == 0) {
+        summarizeTimings();
+    }
+    SDL_memset(gTimings.current, 0, sizeof(gTimings.current));
+}
+
+void initTrace() {
+    if (gTracePath == NULL) {
+        return;
+    }
+    gTracer.enabled = true;
+    gTracer.origin = SDL_GetPerformanceCounter();
+    gTracer.counterToMicroseconds = 1000000.0 / SDL_GetPerformanceFrequency();
+    traceThread("main");
+}
+
+void closeTrace() {
+    if (!gTracer.enabled) {
+        return;
+    }
+    // Other threads may still be recording, so the buffers stay allocated until exit
+    if (writeTrace(gTracePath)) {
+        printf("Wrote trace to %s\n", gTracePath);
+    }
+    gTracer.enabled = false;
+}
+
+// Gives the calling thread its ring buffer on first use, returns NULL when tracing is off or
+// every slot is taken
+TraceBuffer* traceThread(const char* name) {
+    if (!gTracer.enabled) {
+        return NULL;
+    }
+    if (gTraceBuffer == NULL) {
+        int slot = SDL_AtomicAdd(&gTracer.bufferCount, 1);
+        if (slot >= MAX_TRACE_THREADS) {
+            return NULL;
+        }
+        gTraceBuffer = new TraceBuffer();
+        gTraceBuffer->threadName = name;
+        SDL_AtomicSetPtr(&gTracer.buffers[slot], gTraceBuffer);
+    }
+    return gTraceBuffer;
+}
+
+void traceEvent(const char* name, Uint64 start, Uint64 end) {
+    TraceBuffer* buffer = gTraceBuffer != NULL ? gTraceBuffer : traceThread("thread");
+    if (buffer == NULL) {
+        return;
+    }
+    Uint32 index = (Uint32)SDL_AtomicGet(&buffer->written);
+    TraceEvent& event = buffer->events[index & (TRACE_BUFFER_EVENTS - 1)];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    SDL_AtomicSet(&buffer->written, (int)(index + 1));
+}
+
+TraceScope::TraceScope(const char* name) : name(name), start(gTracer.enabled ? SDL_GetPerformanceCounter() : 0) {
+}
+
+TraceScope::~TraceScope() {
+    if (start != 0 && gTracer.enabled) {
+        traceEvent(name, start, SDL_GetPerformanceCounter());
+    }
+}
+
+// Snapshots every thread's ring into a Chrome trace JSON file (chrome://tracing, Perfetto)
+bool writeTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Unable to create trace file %s!\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char* separator = "";
+    int threads = SDL_min(SDL_AtomicGet(&gTracer.bufferCount), MAX_TRACE_THREADS);
+    for (int slot = 0; slot < threads; ++slot) {
+        TraceBuffer* buffer = (TraceBuffer*)SDL_AtomicGetPtr(&gTracer.buffers[slot]);
+        if (buffer == NULL) {
+            continue;
+        }
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                separator, slot, buffer->threadName);
+        separator = ",\n";
+
+        Uint32 written = (Uint32)SDL_AtomicGet(&buffer->written);
+        Uint32 oldest = written > (Uint32)TRACE_BUFFER_EVENTS ? written - TRACE_BUFFER_EVENTS : 0;
+        for (Uint32 index = oldest; index < written; ++index) {
+            TraceEvent event = buffer->events[index & (TRACE_BUFFER_EVENTS - 1)];
+            // The owner keeps recording while we read, skip slots it may have lapped mid-copy
+            if ((Uint32)SDL_AtomicGet(&buffer->written) - index >= (Uint32)TRACE_BUFFER_EVENTS) {
+                continue;
+            }
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    event.name, slot, (Sint64)(event.start - gTracer.origin) * gTracer.counterToMicroseconds,
+                    (event.end - event.start) * gTracer.counterToMicroseconds);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+// SDL_mixer calls this on the audio thread at the end of every mix_channels(), the span between
+// two calls is one audio period as the device pulled it
+void SDLCALL traceAudioMix(void*, Uint8*, int) {
+    static Uint64 previousMix = 0; // only ever touched by the audio thread
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (traceThread("audio") != NULL && previousMix != 0) {
+        traceEvent("audio period", previousMix, now);
+    }
+    previousMix = now;
+}
+
+void summarizeTimings() {
+    float sorted[TIMING_HISTORY];
+    int count = gTimings.historyCount;
+    if (count == 0) {
+        return;
+    }
+
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        SDL_memcpy(sorted, gTimings.history[phase], count * sizeof(float));
+        std::sort(sorted, sorted + count);
+        gTimings.p50[phase] = sorted[(count - 1) * 50 / 100];
+        gTimings.p95[phase] = sorted[(count - 1) * 95 / 100];
+        gTimings.p99[phase] = sorted[(count - 1) * 99 / 100];
+        gTimings.max[phase] = sorted[count - 1];
+    }
+}
+
+void renderTimingHud() {
+    if (!gTimings.hudVisible) {
+        return;
+    }
+
+    int lineHeight = TTF_FontLineSkip(gHudFont);
+    SDL_Rect background = { 5, 50, HUD_WIDTH, lineHeight * (PHASE_COUNT + 4) + 10 };
+    SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 160);
+    SDL_RenderFillRect(gRenderer, &background);
+    SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_NONE);
+
+    // The font is proportional, so every column starts at a fixed x
+    static const char* const columns[] = { "p50", "p95", "p99", "max" };
+    int y = background.y + 5;
+    renderGlyphText(gHudGlyphs, frameFormat("ms, %d frames", gTimings.historyCount), 10, y);
+    for (int column = 0; column < 4; ++column) {
+        renderGlyphText(gHudGlyphs, columns[column], 140 + column * 65, y);
+    }
+
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        const float values[] = { gTimings.p50[phase], gTimings.p95[phase], gTimings.p99[phase], gTimings.max[phase] };
+        y += lineHeight;
+        renderGlyphText(gHudGlyphs, PHASE_NAMES[phase], 10, y);
+        for (int column = 0; column < 4; ++column) {
+            renderGlyphText(gHudGlyphs, frameFormat("%.2f", values[column]), 140 + column * 65, y);
+        }
+    }
+
+    y += lineHeight;
+    renderGlyphText(gHudGlyphs, frameFormat("allocs %u last frame, %u frames since warmup", gTimings.allocations, gTimings.allocatingFrames), 10, y);
+    y += lineHeight;
+    if (gPacer.frameRate != 0) {
+        renderGlyphText(gHudGlyphs, frameFormat("%d fps %s, %u missed deadlines", gPacer.frameRate, gPacer.vsync ? "vsync" : "paced", gPacer.missedDeadlines), 10, y);
+    } else {
+        renderGlyphText(gHudGlyphs, "unpaced", 10, y);
+    }
+    y += lineHeight;
+    renderGlyphText(gHudGlyphs, frameFormat("scene at %d%%, %s, %u changes", gResolution.scale * 100 / RENDER_SCALE_STEPS,
+                                            gResolution.pinned ? "fixed" : "dynamic", gResolution.changes), 10, y);
+}
+
+void renderGameOverScreen(int survivalTime) {
+    int textWidth;
+    int textHeight = TTF_FontHeight(gFont);
+
+    // Render a black screen
+    SDL_Rect fillRect = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(gRenderer, &fillRect);
+
+    // Render Game Over text
+    const char* gameOverText = "Game Over!";
+    textWidth = measureGlyphText(gTextGlyphs, gameOverText);
+    renderGlyphText(gTextGlyphs, gameOverText, (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - textHeight) / 2);
+
+    // Render Survival Time
+    int survivalSeconds = survivalTime / 1000;
+    int survivalMinutes = survivalSeconds / 60;
+    survivalSeconds = survivalSeconds % 60;
+    const char* survivalText = frameFormat("Survived: %d:%02d", survivalMinutes, survivalSeconds);
+    textWidth = measureGlyphText(gTextGlyphs, survivalText);
+    renderGlyphText(gTextGlyphs, survivalText, (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - textHeight) / 2 + 30);
+
+    // Render Restart button wih grey background
+    const char* restartText = "Restart";
+    textWidth = measureGlyphText(gTextGlyphs, restartText);
+    SDL_Rect restartRect = { (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - textHeight) / 2 + 60, textWidth, textHeight };
+    SDL_Rect restartBgRect = { restartRect.x - 10, restartRect.y + 7, restartRect.w + 20, restartRect.h - 8 };
+    SDL_SetRenderDrawColor(gRenderer, RESTART_BUTTON_COLOR.r, RESTART_BUTTON_COLOR.g, RESTART_BUTTON_COLOR.b, RESTART_BUTTON_COLOR.a);
+    SDL_RenderFillRect(gRenderer, &restartBgRect);
+    renderGlyphText(gTextGlyphs, restartText, restartRect.x, restartRect.y);
+}
+
+// Draws the game-over screen into gGameOverTexture once per survival time, returns false when
+// render targets are unavailable and the caller has to draw it directly
+bool bakeGameOverScreen(int survivalTime) {
+    if (gGameOverTexture == NULL) {
+        return false;
+    }
+
+    if (gGameOverTextureTime != survivalTime) {
+        if (SDL_SetRenderTarget(gRenderer, gGameOverTexture) < 0) {
+            printf("Unable to bake game over screen! SDL Error: %s\n", SDL_GetError());
+            return false;
+        }
+        renderGameOverScreen(survivalTime);
+        SDL_SetRenderTarget(gRenderer, NULL);
+        gGameOverTextureTime = survivalTime;
+    }
+    return true;
+}
+
+bool checkCollision(Fixed ax, Fixed ay, int aSize, Fixed bx, Fixed by, int bSize) {
+    Fixed leftA = ax;
+    Fixed rightA = ax + aSize * FIXED_ONE;
+    Fixed topA = ay;
+    Fixed bottomA = ay + aSize * FIXED_ONE;
+
+    Fixed leftB = bx;
+    Fixed rightB = bx + bSize * FIXED_ONE;
+    Fixed topB = by;
+    Fixed bottomB = by + bSize * FIXED_ONE;
+
+    if (bottomA <= topB) {
+        return false;
+    }
+
+    if (topA >= bottomB) {
+        return false;
+    }
+
+    if (rightA <= leftB) {
+        return false;
+    }
+
+    if (leftA >= rightB) {
+        return false;
+    }
+
+    return true;
+}
+
+int ticksToMilliseconds(Uint32 ticks) {
+    return (int)((Uint64)ticks * 1000 / SIM_TICK_RATE);
+}
+
+int interpolate(float previous, float current, float alpha) {
+    return (int)SDL_floorf(previous + (current - previous) * alpha + 0.5f);
+}
+
+int interpolate(Fixed previous, Fixed current, float alpha) {
+    return interpolate(fromFixed(previous), fromFixed(current), alpha);
+}
+
+// Distance an attack spawned at attackSpeed pixels per second covers in one tick
+Fixed attackStep(float attackSpeed) {
+    return (Fixed)SDL_min((Sint64)(attackSpeed * FIXED_ONE / SIM_TICK_RATE), (Sint64)MAX_ATTACK_STEP);
+}
+
+Fixed toFixed(float value) {
+    return (Fixed)SDL_floorf(value * FIXED_ONE + 0.5f);
+}
+
+float fromFixed(Fixed value) {
+    return value * (1.0f / FIXED_ONE);
+}
+
+// libm is only used here, once at startup. Attack directions come from these tables afterwards.
+void initAngleTables() {
+    for (int i = 0; i < ANGLE_STEPS; ++i) {
+        double angle = 2.0 * M_PI * i / ANGLE_STEPS;
+        gDirectionX[i] = (Fixed)floor(cos(angle) * FIXED_ONE + 0.5);
+        gDirectionY[i] = (Fixed)floor(sin(angle) * FIXED_ONE + 0.5);
+    }
+    for (int i = 0; i <= ATAN_STEPS; ++i) {
+        gArctangent[i] = (Uint16)floor(atan((double)i / ATAN_STEPS) * ANGLE_STEPS / (2.0 * M_PI) + 0.5);
+    }
+}
+
+// Angle step of the vector (dx, dy), like atan2(dy, dx) but from the octant and a table lookup
+int angleOf(Sint32 dx, Sint32 dy) {
+    Sint64 absX = dx < 0 ? -(Sint64)dx : dx, absY = dy < 0 ? -(Sint64)dy : dy;
+    if (absX == 0 && absY == 0) {
+        return 0;
+    }
+    // Angle within the first octant, then mirrored out to the real one
+    int angle = absY <= absX ? gArctangent[absY * ATAN_STEPS / absX] : ANGLE_STEPS / 4 - gArctangent[absX * ATAN_STEPS / absY];
+    if (dx < 0) angle = ANGLE_STEPS / 2 - angle;
+    if (dy < 0) angle = ANGLE_STEPS - angle;
+    return angle & (ANGLE_STEPS - 1);
+}
+
+bool startJobSystem(JobSystem& system, int workerCount) {
+    system.workerCount = SDL_clamp(workerCount, 1, MAX_WORKERS);
+    SDL_AtomicSet(&system.remaining, 0);
+    SDL_AtomicSet(&system.busy, 0);
+    SDL_AtomicSet(&system.quit, 0);
+    system.wake = SDL_CreateSemaphore(0);
+    if (system.wake == NULL) {
+        printf("Unable to create job system semaphore! SDL Error: %s\n", SDL_GetError());
+        return false;
+    }
+
+    for (int worker = 1; worker < system.workerCount; ++worker) {
+        system.starts[worker] = { &system, worker };
+        system.threads[worker] = SDL_CreateThread(jobWorkerThread, "job worker", &system.starts[worker]);
+        if (system.threads[worker] == NULL) {
+            // Carry on with the threads we have
+            printf("Warning: Unable to create job worker thread! SDL Error: %s\n", SDL_GetError());
+            system.workerCount = worker;
+            break;
+        }
+    }
+    return true;
+}
+
+void stopJobSystem(JobSystem& system) {
+    SDL_AtomicSet(&system.quit, 1);
+    for (int worker = 1; worker < system.workerCount; ++worker) {
+        SDL_SemPost(system.wake);
+    }
+    for (int worker = 1; worker < system.workerCount; ++worker) {
+        SDL_WaitThread(system.threads[worker], NULL);
+        system.threads[worker] = NULL;
+    }
+    SDL_DestroySemaphore(system.wake);
+    system.wake = NULL;
+}
+
+// Calls function(data, index, worker) for every index in [0, count) across all workers and
+// returns once every call has finished. Not reentrant, jobs must not submit further batches.
+void runJobs(JobSystem& system, JobFunction function, void* data, int count, int grain) {
+    if (count <= 0) {
+        return;
+    }
+    // Helpers can still be looking for work from the last batch, let them give up before the
+    // ranges they scan are reset under them
+    while (SDL_AtomicGet(&system.busy) > 0) {
+        SDL_CPUPauseInstruction();
+    }
+    system.function = function;
+    system.data = data;
+    system.grain = SDL_max(grain, 1);
+    SDL_AtomicSet(&system.remaining, count);
+    for (int worker = 0; worker < system.workerCount; ++worker) {
+        WorkerRange& range = system.ranges[worker];
+        SDL_AtomicLock(&range.lock);
+        range.next = (int)((Sint64)count * worker / system.workerCount);
+        range.end = (int)((Sint64)count * (worker + 1) / system.workerCount);
+        SDL_AtomicUnlock(&range.lock);
+    }
+    for (int worker = 1; worker < system.workerCount; ++worker) {
+        SDL_SemPost(system.wake);
+    }
+
+    // Help until the batch is done, other workers may still be finishing their last chunk
+    while (SDL_AtomicGet(&system.remaining) > 0) {
+        if (!runAvailableJobs(system, 0)) {
+            SDL_CPUPauseInstruction();
+        }
+    }
+}
+
+// Runs chunks from this worker's range, then steals, until no work is left anywhere.
+// Returns false if it found nothing to do.
+bool runAvailableJobs(JobSystem& system, int worker) {
+    WorkerRange& own = system.ranges[worker];
+    bool ranAny = false;
+    while (true) {
+        SDL_AtomicLock(&own.lock);
+        int begin = own.next;
+        int end = SDL_min(begin + system.grain, own.end);
+        own.next = SDL_max(end, begin);
+        SDL_AtomicUnlock(&own.lock);
+
+        if (begin < end) {
+            for (int index = begin; index < end; ++index) {
+                system.function(system.data, index, worker);
+            }
+            SDL_AtomicAdd(&system.remaining, -(end - begin));
+            ranAny = true;
+            continue;
+        }
+
+        // Own range is empty, steal the back half of the fullest one
+        int victim = -1, victimSize = 0;
+        for (int other = 0; other < system.workerCount; ++other) {
+            if (other == worker) {
+                continue;
+            }
+            SDL_AtomicLock(&system.ranges[other].lock);
+            int size = system.ranges[other].end - system.ranges[other].next;
+            SDL_AtomicUnlock(&system.ranges[other].lock);
+            if (size > victimSize) {
+                victim = other;
+                victimSize = size;
+            }
+        }
+        if (victim < 0) {
+            return ranAny;
+        }
+
+        WorkerRange& from = system.ranges[victim];
+        SDL_AtomicLock(&from.lock);
+        int stolenBegin = from.next + (from.end - from.next) / 2;
+        int stolenEnd = from.end;
+        if (stolenBegin < stolenEnd) {
+            from.end = stolenBegin;
+        }
+        SDL_AtomicUnlock(&from.lock);
+
+        if (stolenBegin >= stolenEnd) {
+            continue;
+        }
+        // Only take over the stolen range while our own is still empty. If a new batch handed
+        // us a range in the meantime, overwriting it would lose those indices, so run the
+        // stolen ones here instead.
+        SDL_AtomicLock(&own.lock);
+        bool install = own.next >= own.end;
+        if (install) {
+            own.next = stolenBegin;
+            own.end = stolenEnd;
+        }
+        SDL_AtomicUnlock(&own.lock);
+        if (!install) {
+            for (int index = stolenBegin; index < stolenEnd; ++index) {
+                system.function(system.data, index, worker);
+            }
+            SDL_AtomicAdd(&system.remaining, -(stolenEnd - stolenBegin));
+            ranAny = true;
+        }
+    }
+}
+
+int jobWorkerThread(void* data) {
+    JobWorkerStart start = *(JobWorkerStart*)data;
+    JobSystem& system = *start.system;
+    traceThread("job worker");
+    while (true) {
+        SDL_SemWait(system.wake);
+        if (SDL_AtomicGet(&system.quit)) {
+            return 0;
+        }
+        SDL_AtomicIncRef(&system.busy);
+        runAvailableJobs(system, start.worker);
+        SDL_AtomicDecRef(&system.busy);
+    }
+}
+
+// Input a bot would give for the next tick. Decisions are only made every BOT_DECISION_TICKS,
+// in between the previous input is held like a human holding a key.
+Uint8 botInput(const World& world, BotPolicy policy, Rng& rng, Uint8 previous, LookaheadBot* lookahead) {
+    if (policy == BOT_IDLE || world.simTicks % BOT_DECISION_TICKS != 0) {
+        return policy == BOT_IDLE ? 0 : previous;
+    }
+    if (policy == BOT_LOOKAHEAD) {
+        return lookahead != NULL ? lookaheadInput(*lookahead, world, previous) : previous;
+    }
+
+    float moveX = 0, moveY = 0;
+    if (policy == BOT_RANDOM) {
+        moveX = (float)randomInt(rng, 3) - 1;
+        moveY = (float)randomInt(rng, 3) - 1;
+    } else {
+        // Sum of pushes away from every close attack that is still approaching, plus a weak pull
+        // toward the centre so the bot doesn't get pinned against a wall
+        const GameObject& player = world.player;
+        float centerX = player.x + PLAYER_SIZE / 2, centerY = player.y + PLAYER_SIZE / 2;
+        const AttackPool& attacks = world.attacks;
+        for (int i = 0; i < attacks.count; ++i) {
+            float dx = centerX - (fromFixed(attacks.x[i]) + ATTACK_SIZE / 2);
+            float dy = centerY - (fromFixed(attacks.y[i]) + ATTACK_SIZE / 2);
+            float velX = fromFixed(attacks.velX[i]) * SIM_TICK_RATE, velY = fromFixed(attacks.velY[i]) * SIM_TICK_RATE;
+            float distance = SDL_sqrtf(dx * dx + dy * dy) + 1.0f;
+            if (distance > BOT_DANGER_RADIUS || dx * velX + dy * velY <= 0) {
+                continue;
+            }
+            // Sidestep perpendicular to the attack's path, on whichever side the player already is
+            float side = dx * velY - dy * velX >= 0 ? 1.0f : -1.0f;
+            float weight = (BOT_DANGER_RADIUS - distance) / (BOT_DANGER_RADIUS * distance);
+            moveX += (dx + side * velY * distance / world.attackSpeed) * weight;
+            moveY += (dy - side * velX * distance / world.attackSpeed) * weight;
+        }
+        moveX += (SCREEN_WIDTH / 2 - centerX) / (SCREEN_WIDTH * 8.0f);
+        moveY += (SCREEN_HEIGHT / 2 - centerY) / (SCREEN_HEIGHT * 8.0f);
+        float length = SDL_fabsf(moveX) + SDL_fabsf(moveY);
+        // Only commit to an axis when it is a real part of the escape direction
+        moveX = SDL_fabsf(moveX) > length * 0.25f ? moveX : 0;
+        moveY = SDL_fabsf(moveY) > length * 0.25f ? moveY : 0;
+    }
+
+    Uint8 input = previous & INPUT_FACE_RIGHT;
+    if (moveX < 0) input = INPUT_LEFT;
+    if (moveX > 0) input = INPUT_RIGHT | INPUT_FACE_RIGHT;
+    if (moveY < 0) input |= INPUT_UP;
+    if (moveY > 0) input |= INPUT_DOWN;
+    return input;
+}
+
+bool startLookaheadBot(LookaheadBot& bot, JobSystem* jobs, double budgetMilliseconds) {
+    bot = {};
+    bot.jobs = jobs;
+    bot.horizon = LOOKAHEAD_TICKS;
+    bot.budgetMilliseconds = budgetMilliseconds;
+    bot.root = new Snapshot();
+    for (int worker = 0; worker < (bot.jobs != NULL ? bot.jobs->workerCount : 1); ++worker) {
+        bot.scratch[worker] = new World();
+    }
+    return true;
+}
+
+void stopLookaheadBot(LookaheadBot& bot) {
+    for (int worker = 0; worker < MAX_WORKERS; ++worker) {
+        delete bot.scratch[worker];
+    }
+    delete bot.root;
+    bot = {};
+}
+
+const Uint8 LOOKAHEAD_MOVES[LOOKAHEAD_CANDIDATES] = {
+    0, INPUT_UP, INPUT_DOWN, INPUT_LEFT, INPUT_RIGHT | INPUT_FACE_RIGHT,
+    INPUT_UP | INPUT_LEFT, INPUT_UP | INPUT_RIGHT | INPUT_FACE_RIGHT, INPUT_DOWN | INPUT_LEFT, INPUT_DOWN | INPUT_RIGHT | INPUT_FACE_RIGHT
+};
+
+// One job per candidate move. Scores ticks survived first, then the clearance to the nearest
+// attack at the horizon, minus a little for straying from the centre.
+void runLookaheadJob(void* data, int index, int worker) {
+    LookaheadBot& bot = *(LookaheadBot*)data;
+    World& world = *bot.scratch[worker];
+    restoreSnapshot(world, *bot.root);
+    world.invulnerable = false; // a rollout ends at the first hit even when the real player can't die
+
+    applyInput(LOOKAHEAD_MOVES[index], world.player);
+    int ticks = 0;
+    for (; ticks < bot.horizon && !world.gameOver; ++ticks) {
+        stepSimulation(world);
+    }
+
+    float clearance = 0;
+    if (!world.gameOver) {
+        const GameObject& player = world.player;
+        float centerX = player.x + PLAYER_SIZE / 2, centerY = player.y + PLAYER_SIZE / 2;
+        float nearest = BOT_DANGER_RADIUS * BOT_DANGER_RADIUS;
+        const AttackPool& attacks = world.attacks;
+        for (int i = 0; i < attacks.count; ++i) {
+            float dx = centerX - (fromFixed(attacks.x[i]) + ATTACK_SIZE / 2);
+            float dy = centerY - (fromFixed(attacks.y[i]) + ATTACK_SIZE / 2);
+            nearest = SDL_min(nearest, dx * dx + dy * dy);
+        }
+        clearance = SDL_sqrtf(nearest) - 0.1f * (SDL_fabsf(SCREEN_WIDTH / 2 - centerX) + SDL_fabsf(SCREEN_HEIGHT / 2 - centerY));
+    }
+    bot.scores[index] = ticks * BOT_DANGER_RADIUS + clearance;
+}
+
+Uint8 lookaheadInput(LookaheadBot& bot, const World& world, Uint8 previous) {
+    TraceScope trace("lookahead");
+    Uint64 start = SDL_GetPerformanceCounter();
+    saveSnapshot(world, *bot.root);
+    if (bot.jobs != NULL) {
+        // The rollouts already keep every worker busy, and runJobs() isn't reentrant
+        JobSystem* attackJobs = gAttackJobs;
+        gAttackJobs = NULL;
+        runJobs(*bot.jobs, runLookaheadJob, &bot, LOOKAHEAD_CANDIDATES, 1);
+        gAttackJobs = attackJobs;
+    } else {
+        for (int candidate = 0; candidate < LOOKAHEAD_CANDIDATES; ++candidate) {
+            runLookaheadJob(&bot, candidate, 0);
+        }
+    }
+
+    // Keep the current move on a tie so the bot doesn't jitter between equal options
+    int best = 0;
+    for (int candidate = 1; candidate < LOOKAHEAD_CANDIDATES; ++candidate) {
+        if (bot.scores[candidate] > bot.scores[best]) {
+            best = candidate;
+        }
+    }
+    for (int candidate = 0; candidate < LOOKAHEAD_CANDIDATES; ++candidate) {
+        if (LOOKAHEAD_MOVES[candidate] == (previous & ~INPUT_FACE_RIGHT & ~INPUT_RESTART) && bot.scores[candidate] >= bot.scores[best]) {
+            best = candidate;
+        }
+    }
+
+    if (bot.budgetMilliseconds > 0) {
+        double milliseconds = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+        if (milliseconds > bot.budgetMilliseconds) {
+            bot.horizon = SDL_max(bot.horizon * 3 / 4, LOOKAHEAD_MIN_TICKS);
+        } else if (milliseconds < bot.budgetMilliseconds / 2) {
+            bot.horizon = SDL_min(bot.horizon + BOT_DECISION_TICKS, LOOKAHEAD_TICKS);
+        }
+    }
+
+    Uint8 input = LOOKAHEAD_MOVES[best];
+    if (!(input & (INPUT_LEFT | INPUT_RIGHT))) {
+        input |= previous & INPUT_FACE_RIGHT; // keep facing the way we last walked
+    }
+    return input;
+}
+
+// "value" or "min:max:step"
+bool parseSweepRange(const char* text, SweepRange& range) {
+    float min, max, step;
+    int fields = SDL_sscanf(text, "%f:%f:%f", &min, &max, &step);
+    if (fields == 1) {
+        range = { min, min, 1 };
+    } else if (fields == 3 && step > 0 && max >= min) {
+        range = { min, max, step };
+    } else {
+        printf("Invalid sweep range %s, expected value or min:max:step!\n", text);
+        return false;
+    }
+    return true;
+}
+
+bool parseBotPolicy(const char* text, BotPolicy& policy) {
+    for (int i = 0; i < (int)SDL_arraysize(BOT_POLICY_NAMES); ++i) {
+        if (SDL_strcmp(text, BOT_POLICY_NAMES[i]) == 0) {
+            policy = (BotPolicy)i;
+            return true;
+        }
+    }
+    printf("Unknown bot policy %s!\n", text);
+    return false;
+}
+
+int sweepSteps(const SweepRange& range) {
+    return (int)SDL_floorf((range.max - range.min) / range.step + 1e-3f) + 1;
+}
+
+struct SweepJobs {
+    std::vector<Tuning> sets;
+    int runs;
+    Uint32 maxTicks;
+    BotPolicy policy;
+    World* worlds[MAX_WORKERS]; // one reusable world per worker
+    LookaheadBot lookahead[MAX_WORKERS]; // serial lookahead per worker, the workers are busy with runs
+    std::vector<int> survival; // milliseconds, sets.size() * runs, set-major
+    std::vector<Uint8> capped; // run reached maxTicks alive
+};
+
+// One job is one full run of one parameter set
+void runSweepJob(void* data, int index, int worker) {
+    TraceScope trace("sweep run");
+    SweepJobs& jobs = *(SweepJobs*)data;
+    World& world = *jobs.worlds[worker];
+    int run = index % jobs.runs;
+    resetWorld(world, gSeed + run, jobs.sets[index / jobs.runs]);
+
+    Rng botRng;
+    seedRandom(botRng, ~(gSeed + run));
+    Uint8 input = 0;
+    while (!world.gameOver && world.simTicks < jobs.maxTicks) {
+        input = botInput(world, jobs.policy, botRng, input, &jobs.lookahead[worker]);
+        applyInput(input, world.player);
+        stepSimulation(world);
+    }
+    jobs.survival[index] = world.gameOver ? world.survivalTime : ticksToMilliseconds(world.simTicks);
+    jobs.capped[index] = !world.gameOver;
+}
+
+// Plays every combination of the swept parameters gSweep.runs times with a bot and writes
+// one CSV row per combination with the survival time distribution in seconds
+bool runSweep(const char* path) {
+    SweepJobs jobs;
+    jobs.runs = gSweep.runs;
+    jobs.maxTicks = gMaxTicks > 0 ? gMaxTicks : SWEEP_DEFAULT_MAX_TICKS;
+    jobs.policy = gSweep.policy;
+    for (int a = 0; a < sweepSteps(gSweep.spawnInterval); ++a) {
+        for (int b = 0; b < sweepSteps(gSweep.changeInterval); ++b) {
+            for (int c = 0; c < sweepSteps(gSweep.attackSpeed); ++c) {
+                for (int d = 0; d < sweepSteps(gSweep.speedRamp); ++d) {
+                    Tuning tuning = { (int)(gSweep.spawnInterval.min + a * gSweep.spawnInterval.step),
+                                      SDL_max((int)(gSweep.changeInterval.min + b * gSweep.changeInterval.step), 1),
+                                      gSweep.attackSpeed.min + c * gSweep.attackSpeed.step,
+                                      gSweep.speedRamp.min + d * gSweep.speedRamp.step };
+                    jobs.sets.push_back(tuning);
+                }
+            }
+        }
+    }
+    int total = (int)jobs.sets.size() * jobs.runs;
+    jobs.survival.assign(total, 0);
+    jobs.capped.assign(total, 0);
+
+    FILE* csv = fopen(path, "w");
+    if (csv == NULL) {
+        printf("Unable to open sweep output %s!\n", path);
+        return false;
+    }
+
+    JobSystem& system = *new JobSystem();
+    if (!startJobSystem(system, gThreadCount > 0 ? gThreadCount : SDL_GetCPUCount())) {
+        fclose(csv);
+        delete &system;
+        return false;
+    }
+    for (int worker = 0; worker < system.workerCount; ++worker) {
+        jobs.worlds[worker] = new World();
+        if (jobs.policy == BOT_LOOKAHEAD) {
+            startLookaheadBot(jobs.lookahead[worker], NULL, 0);
+        }
+    }
+
+    Uint64 startCounter = SDL_GetPerformanceCounter();
+    runJobs(system, runSweepJob, &jobs, total, 1);
+    double wallSeconds = (double)(SDL_GetPerformanceCounter() - startCounter) / SDL_GetPerformanceFrequency();
+
+    fprintf(csv, "spawn_interval_ms,change_interval_ms,attack_speed,speed_ramp,policy,runs,capped,mean_s,stddev_s,min_s,p10_s,p25_s,p50_s,p75_s,p90_s,max_s\n");
+    double simulatedSeconds = 0;
+    std::vector<int> sorted(jobs.runs);
+    for (size_t set = 0; set < jobs.sets.size(); ++set) {
+        const int* survival = &jobs.survival[set * jobs.runs];
+        double sum = 0, sumSquares = 0;
+        int capped = 0;
+        for (int run = 0; run < jobs.runs; ++run) {
+            sum += survival[run] / 1000.0;
+            sumSquares += (survival[run] / 1000.0) * (survival[run] / 1000.0);
+            capped += jobs.capped[set * jobs.runs + run];
+            sorted[run] = survival[run];
+        }
+        simulatedSeconds += sum;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = sum / jobs.runs;
+        double variance = SDL_max(sumSquares / jobs.runs - mean * mean, 0.0);
+        const double percentiles[] = { 0.10, 0.25, 0.50, 0.75, 0.90 };
+        const Tuning& tuning = jobs.sets[set];
+        fprintf(csv, "%d,%d,%.2f,%.3f,%s,%d,%d,%.3f,%.3f,%.3f", tuning.spawnInterval, tuning.changeInterval, tuning.initialAttackSpeed,
+                tuning.speedRamp, BOT_POLICY_NAMES[jobs.policy], jobs.runs, capped, mean, SDL_sqrt(variance), sorted[0] / 1000.0);
+        for (double percentile : percentiles) {
+            fprintf(csv, ",%.3f", sorted[(int)(percentile * (jobs.runs - 1) + 0.5)] / 1000.0);
+        }
+        fprintf(csv, ",%.3f\n", sorted[jobs.runs - 1] / 1000.0);
+    }
+    fclose(csv);
+
+    printf("Swept %d parameter sets x %d runs with the %s bot on %d threads in %.2f s\n",
+           (int)jobs.sets.size(), jobs.runs, BOT_POLICY_NAMES[jobs.policy], system.workerCount, wallSeconds);
+    printf("Simulated %.0f s of play, %.0f simulated seconds per wall-clock minute\n", simulatedSeconds, wallSeconds > 0 ? simulatedSeconds / wallSeconds * 60 : 0.0);
+
+    stopJobSystem(system);
+    for (int worker = 0; worker < system.workerCount; ++worker) {
+        delete jobs.worlds[worker];
+        if (jobs.policy == BOT_LOOKAHEAD) {
+            stopLookaheadBot(jobs.lookahead[worker]);
+        }
+    }
+    delete &system;
     return true;
 }